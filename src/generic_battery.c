@@ -0,0 +1,105 @@
+/*
+ * Battery level from the supply voltage
+ */
+
+#include "generic_battery.h"
+#include "generic_sensor_adc.h"
+
+#include <errno.h>
+#include <stdlib.h>
+#include <zephyr.h>
+#include <bluetooth/services/bas.h>
+#include <logging/log.h>
+
+LOG_MODULE_REGISTER(generic_battery, CONFIG_GENERIC_BATTERY_LOG_LEVEL);
+
+#define EMPTY_MV            CONFIG_GENERIC_BATTERY_EMPTY_MV
+#define FULL_MV             CONFIG_GENERIC_BATTERY_FULL_MV
+
+/* Low pass weight of a new measurement, 1 / 2^FILTER_SHIFT */
+#define FILTER_SHIFT        2
+#define FILTER_Q            4
+
+/*
+ * A new percentage is only reported once the level is this many tenths
+ * of a percent away from the reported one, so noise on a boundary does
+ * not toggle it back and forth.
+ */
+#define HYSTERESIS_PERMILLE 7
+
+BUILD_ASSERT(FULL_MV > EMPTY_MV, "Battery full voltage must exceed empty");
+
+static const struct device *m_adc;
+static uint32_t m_mv_q;
+static int m_reported = -1;
+
+static void measure_work_handler(struct k_work *work);
+static K_WORK_DELAYABLE_DEFINE(m_measure_work, measure_work_handler);
+
+static int permille(uint32_t mv)
+{
+    if (mv <= EMPTY_MV) {
+        return 0;
+    }
+    if (mv >= FULL_MV) {
+        return 1000;
+    }
+
+    return (mv - EMPTY_MV) * 1000 / (FULL_MV - EMPTY_MV);
+}
+
+static void measure(void)
+{
+    uint16_t mv;
+    int level;
+    int err;
+
+    err = generic_sensor_adc_supply(m_adc, &mv);
+    if (err) {
+        LOG_DBG("No supply measurement (err %d)", err);
+        return;
+    }
+
+    if (!m_mv_q) {
+        m_mv_q = (uint32_t)mv << FILTER_Q;
+    } else {
+        m_mv_q += (int32_t)(((uint32_t)mv << FILTER_Q) - m_mv_q) >>
+                  FILTER_SHIFT;
+    }
+
+    level = permille(m_mv_q >> FILTER_Q);
+    if (m_reported >= 0 &&
+        abs(level - m_reported * 10) <= HYSTERESIS_PERMILLE) {
+        return;
+    }
+
+    /* Rounded, a change of the percentage is what gets notified */
+    level = (level + 5) / 10;
+    if (level == m_reported) {
+        return;
+    }
+
+    m_reported = level;
+    LOG_INF("Battery %u mV, %d%%", m_mv_q >> FILTER_Q, level);
+    bt_bas_set_battery_level(level);
+}
+
+static void measure_work_handler(struct k_work *work)
+{
+    measure();
+    k_work_reschedule(&m_measure_work,
+                      K_SECONDS(CONFIG_GENERIC_BATTERY_INTERVAL));
+}
+
+uint16_t generic_battery_mv(void)
+{
+    return m_mv_q >> FILTER_Q;
+}
+
+int generic_battery_init(const struct device *adc)
+{
+    m_adc = adc;
+
+    /* The first measurement runs now, before any central reads the level */
+    return k_work_schedule(&m_measure_work, K_NO_WAIT) < 0 ? -EIO : 0;
+}
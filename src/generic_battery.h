@@ -0,0 +1,34 @@
+/*
+ * Battery level from the supply voltage
+ *
+ * Every CONFIG_GENERIC_BATTERY_INTERVAL seconds the mean supply voltage of
+ * the sensor ADC's scans is run through a first order low pass and mapped
+ * linearly onto 0..100% between CONFIG_GENERIC_BATTERY_EMPTY_MV and
+ * CONFIG_GENERIC_BATTERY_FULL_MV. The Battery Service level is only
+ * updated, and thereby notified, when that percentage changes.
+ */
+
+#include <stdint.h>
+#include <device.h>
+
+#ifndef GENERIC_BATTERY__H
+#define GENERIC_BATTERY__H
+
+#ifdef CONFIG_GENERIC_BATTERY
+
+/* Take the first measurement on adc, a sensor ADC instance, and schedule */
+int generic_battery_init(const struct device *adc);
+
+/* Filtered supply voltage, 0 before the first measurement */
+uint16_t generic_battery_mv(void);
+
+#else
+
+static inline int generic_battery_init(const struct device *adc)
+{
+    return 0;
+}
+
+#endif
+
+#endif
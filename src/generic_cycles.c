@@ -0,0 +1,22 @@
+/*
+ * Cycle counter for short durations
+ */
+
+#include "generic_cycles.h"
+
+#include <init.h>
+
+#ifdef CONFIG_TIMING_FUNCTIONS
+/* Enables the DWT counter, before the first stage or idle exit is timed */
+static int generic_cycles_init(const struct device *dev)
+{
+    ARG_UNUSED(dev);
+
+    timing_init();
+    timing_start();
+
+    return 0;
+}
+
+SYS_INIT(generic_cycles_init, PRE_KERNEL_2, 0);
+#endif
@@ -0,0 +1,44 @@
+/*
+ * Cycle counter for short durations
+ *
+ * k_cycle_get_32() counts the system timer, which on nRF52 is the
+ * 32.768 kHz RTC: anything shorter than about 30 us reads as zero. With
+ * CONFIG_TIMING_FUNCTIONS durations are taken from the timing API
+ * instead, the DWT cycle counter on Cortex-M. Both wrap at 32 bits, so a
+ * duration is the unsigned difference of two readings.
+ */
+
+#ifndef GENERIC_CYCLES__H
+#define GENERIC_CYCLES__H
+
+#include <stdint.h>
+#include <zephyr.h>
+#ifdef CONFIG_TIMING_FUNCTIONS
+#include <timing/timing.h>
+#endif
+
+static inline uint32_t generic_cycles_get(void)
+{
+#ifdef CONFIG_TIMING_FUNCTIONS
+    return (uint32_t)timing_counter_get();
+#else
+    return k_cycle_get_32();
+#endif
+}
+
+static inline uint32_t generic_cycles_per_sec(void)
+{
+#ifdef CONFIG_TIMING_FUNCTIONS
+    return (uint32_t)timing_freq_get();
+#else
+    return sys_clock_hw_cycles_per_sec();
+#endif
+}
+
+static inline uint32_t generic_cycles_to_ns(uint32_t cycles)
+{
+    return (uint32_t)((uint64_t)cycles * 1000000000U /
+                      generic_cycles_per_sec());
+}
+
+#endif
@@ -1,11 +1,17 @@
 /*
- * Simple functions to control board LEDs
+ * Board LED status patterns
  */
 
-#include <sys/printk.h>
+#include "generic_led.h"
+
+#include <errno.h>
+#include <zephyr.h>
 #include <device.h>
 #include <devicetree.h>
 #include <drivers/gpio.h>
+#include <logging/log.h>
+
+LOG_MODULE_REGISTER(generic_led, CONFIG_GENERIC_LED_LOG_LEVEL);
 
 #define LED0_NODE DT_ALIAS(led0)
 #define LED0    DT_GPIO_LABEL(LED0_NODE, gpios)
@@ -17,59 +23,159 @@
 #define PIN1	    DT_GPIO_PIN(LED1_NODE, gpios)
 #define FLAGS1   DT_GPIO_FLAGS(LED1_NODE, gpios)
 
-const struct device *led0_dev;
-const struct device *led1_dev;
-bool led0_is_on = true;
-bool led1_is_on = false;
+/* LEDs lit during a step */
+#define RED     BIT(0)
+#define BLUE    BIT(1)
 
-int generic_led_init(void){
-    // Config LED
-    int err;
-    led0_dev = device_get_binding(LED0);
-    if (led0_dev == NULL) {
-        printk("No device for LED0.");
-        return -1;
+struct led_step {
+    uint16_t ms;        /* 0: hold until the pattern changes */
+    uint8_t leds;
+};
+
+struct led_pattern {
+    const struct led_step *steps;
+    uint8_t count;
+    bool repeat;
+};
+
+#define LED_PATTERN(_repeat, ...)                                       \
+    {                                                                   \
+        .steps = (const struct led_step[]){ __VA_ARGS__ },              \
+        .count = sizeof((const struct led_step[]){ __VA_ARGS__ }) /     \
+                 sizeof(struct led_step),                               \
+        .repeat = _repeat,                                              \
     }
-    err = gpio_pin_configure(led0_dev, PIN0, GPIO_OUTPUT_ACTIVE | FLAGS0);
-    if (err < 0) {
-        printk("GPIO config error in LED0.");
-        return -1;
+
+static const struct led_pattern m_patterns[GENERIC_LED_STATE_COUNT] = {
+    [GENERIC_LED_OFF] = LED_PATTERN(false, { 0, 0 }),
+    [GENERIC_LED_ADVERTISING] = LED_PATTERN(true,
+        { 50, RED }, { 950, 0 }),
+    [GENERIC_LED_CONNECTED] = LED_PATTERN(false, { 0, RED }),
+    [GENERIC_LED_STREAMING] = LED_PATTERN(true,
+        { 50, RED | BLUE }, { 950, RED }),
+    [GENERIC_LED_ERROR] = LED_PATTERN(true,
+        { 100, RED }, { 100, 0 }),
+    [GENERIC_LED_OVERFLOW] = LED_PATTERN(false,
+        { 80, BLUE }, { 80, 0 }, { 80, BLUE }, { 80, 0 },
+        { 80, BLUE }, { 240, 0 }),
+};
+
+static const struct device *led0_dev;
+static const struct device *led1_dev;
+
+static void timer_expiry(struct k_timer *timer);
+static K_TIMER_DEFINE(m_timer, timer_expiry, NULL);
+
+/* Shared by the timer ISR and the callers */
+static struct k_spinlock m_lock;
+static const struct led_pattern *m_state = &m_patterns[GENERIC_LED_OFF];
+static const struct led_pattern *m_playing = &m_patterns[GENERIC_LED_OFF];
+static uint8_t m_step;
+
+/* Must be called with m_lock held */
+static void play_step(void)
+{
+    const struct led_step *step = &m_playing->steps[m_step];
+
+    if (led0_dev) {
+        gpio_pin_set(led0_dev, PIN0, !!(step->leds & RED));
     }
-    led1_dev = device_get_binding(LED1);
-    if (led1_dev == NULL) {
-        printk("No device.");
-        return -1;
+    if (led1_dev) {
+        gpio_pin_set(led1_dev, PIN1, !!(step->leds & BLUE));
     }
-    err = gpio_pin_configure(led1_dev, PIN1, GPIO_OUTPUT_ACTIVE | FLAGS1);
-    if (err < 0) {
-        printk("GPIO config error.");
-        return -1;
+
+    if (step->ms) {
+        k_timer_start(&m_timer, K_MSEC(step->ms), K_NO_WAIT);
+    } else {
+        k_timer_stop(&m_timer);
     }
-    gpio_pin_set(led1_dev, PIN0, (int)(0));
-    gpio_pin_set(led1_dev, PIN1, (int)(0));
-    return 0;
 }
 
-void red_led_on(void){
-    gpio_pin_set(led0_dev, PIN0, (int)(1));
-    led0_is_on = 1;
-    // printk("led\n");
+/* Must be called with m_lock held */
+static void play(const struct led_pattern *pattern)
+{
+    m_playing = pattern;
+    m_step = 0;
+    play_step();
 }
 
-void red_led_blink(void){
-    gpio_pin_set(led0_dev, PIN0, (int)(led0_is_on));
-    led0_is_on = !led0_is_on;
-    // printk("led\n");
+static void timer_expiry(struct k_timer *timer)
+{
+    k_spinlock_key_t key = k_spin_lock(&m_lock);
+
+    if (++m_step < m_playing->count) {
+        play_step();
+    } else if (m_playing->repeat) {
+        play(m_playing);
+    } else {
+        /* An event is over, a one-shot state just holds its last step */
+        if (m_playing != m_state) {
+            play(m_state);
+        }
+    }
+
+    k_spin_unlock(&m_lock, key);
 }
 
-void blue_led_on(void){
-    gpio_pin_set(led1_dev, PIN1, (int)(1));
-    led1_is_on = 1;
-    // printk("led\n");
+void generic_led_set_state(enum generic_led_state state)
+{
+    k_spinlock_key_t key = k_spin_lock(&m_lock);
+    const struct led_pattern *pattern = &m_patterns[state];
+    bool event = m_playing != m_state;
+
+    if (m_state != &m_patterns[GENERIC_LED_ERROR] && m_state != pattern) {
+        m_state = pattern;
+        /* A running event finishes first and then picks up the state */
+        if (!event) {
+            play(pattern);
+        }
+    }
+
+    k_spin_unlock(&m_lock, key);
+}
+
+void generic_led_event(enum generic_led_state event)
+{
+    k_spinlock_key_t key = k_spin_lock(&m_lock);
+    const struct led_pattern *pattern = &m_patterns[event];
+
+    if (m_playing != pattern && m_state != &m_patterns[GENERIC_LED_ERROR]) {
+        play(pattern);
+    }
+
+    k_spin_unlock(&m_lock, key);
+}
+
+static const struct device *led_configure(const char *label, gpio_pin_t pin,
+                                          gpio_flags_t flags)
+{
+    const struct device *dev = device_get_binding(label);
+    int err;
+
+    if (dev == NULL) {
+        LOG_ERR("No device for %s.", label);
+        return NULL;
+    }
+
+    err = gpio_pin_configure(dev, pin, GPIO_OUTPUT_INACTIVE | flags);
+    if (err < 0) {
+        LOG_ERR("GPIO config error in %s.", label);
+        return NULL;
+    }
+
+    return dev;
 }
 
-void blue_led_blink(void){
-    gpio_pin_set(led1_dev, PIN1, (int)(led0_is_on));
-    led1_is_on = !led1_is_on;
-    // printk("led\n");
+int generic_led_init(void)
+{
+    k_spinlock_key_t key;
+
+    led0_dev = led_configure(LED0, PIN0, FLAGS0);
+    led1_dev = led_configure(LED1, PIN1, FLAGS1);
+
+    key = k_spin_lock(&m_lock);
+    play(m_state);
+    k_spin_unlock(&m_lock, key);
+
+    return led0_dev && led1_dev ? 0 : -ENODEV;
 }
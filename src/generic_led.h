@@ -1,15 +1,35 @@
 /*
- * Simple functions to control board LEDs
+ * Board LED status patterns
+ *
+ * Each state is a table of steps, every step a duration and the LEDs lit
+ * during it. A one-shot k_timer fires once per edge and sets up the next
+ * one, so nothing runs between edges and a steady pattern needs no timer
+ * at all. Events play their pattern once over the current state, which
+ * then resumes from its first step.
  */
 
 #ifndef GENERIC_LED__H
 #define GENERIC_LED__H
 
+enum generic_led_state {
+    GENERIC_LED_OFF,
+    GENERIC_LED_ADVERTISING,    /* short red flash every second */
+    GENERIC_LED_CONNECTED,      /* red on */
+    GENERIC_LED_STREAMING,      /* red on, blue heartbeat */
+    GENERIC_LED_ERROR,          /* fast red blink, final */
+    GENERIC_LED_OVERFLOW,       /* event: blue triple flash, frames lost */
+    GENERIC_LED_STATE_COUNT
+};
+
 int generic_led_init(void);
-void red_led_blink(void);
-void red_led_on(void);
-void blue_led_blink(void);
-void blue_led_on(void);
 
-#endif
+/* Switch to the pattern of state. Once in GENERIC_LED_ERROR it stays. */
+void generic_led_set_state(enum generic_led_state state);
+
+/*
+ * Play the pattern of event once, then go back to the current state.
+ * Ignored while the same event is still playing. Callable from ISRs.
+ */
+void generic_led_event(enum generic_led_state event);
 
+#endif
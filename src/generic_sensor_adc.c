@@ -4,211 +4,1199 @@
  * SPDX-License-Identifier: LicenseRef-BSD-5-Clause-Nordic
  */
 
+#define DT_DRV_COMPAT generic_sensor_adc
+
 #include "generic_sensor_adc.h"
+#include "generic_sensor_math.h"
+#include "generic_sensor_metrics.h"
+#include "generic_sensor_time.h"
 
-#include <stdio.h>
+#include <errno.h>
 #include <string.h>
-#include <drivers/uart.h>
 #include <drivers/adc.h>
+#include <drivers/sensor.h>
+#include <version.h>
 #include <zephyr.h>
+#include <logging/log.h>
 
-const struct device *adc_dev;
+LOG_MODULE_REGISTER(generic_sensor_adc, CONFIG_GENERIC_SENSOR_ADC_LOG_LEVEL);
 
+#ifdef CONFIG_ADC_NRFX_SAADC
 #include <hal/nrf_saadc.h>
-#define ADC_DEVICE_NAME DT_ADC_0_NAME
+#endif
+
+/*
+ * In-place scans on the nRF SAADC
+ *
+ * The continuous callback points the SAADC result DMA at the next frame of
+ * the caller's block, behind the back of the adc_nrfx_saadc driver. That
+ * relies on how the Zephyr 2.7 driver runs an ADC_ACTION_REPEAT sequence:
+ *
+ * - the callback runs from the END event handler, and the next scan only
+ *   starts with TASKS_START from the interval timer, which latches
+ *   RESULT.PTR;
+ * - adc_context_update_buffer_pointer() leaves RESULT.PTR alone on a
+ *   repeat, only ADC_ACTION_CONTINUE (never returned here) advances it;
+ * - start_read() sets RESULT.MAXCNT once to the enabled channels, so with
+ *   the supply channel every scan writes one sample past its frame.
+ *
+ * Any other driver or kernel version keeps the sequence buffer and copies
+ * each scan into the block.
+ */
+#if defined(CONFIG_ADC_NRFX_SAADC) && \
+    KERNEL_VERSION_MAJOR == 2 && KERNEL_VERSION_MINOR == 7
+#define ADC_SCAN_IN_PLACE   1
+
+static inline void saadc_dma_set(int16_t *buf)
+{
+    nrf_saadc_buffer_pointer_set(NRF_SAADC, buf);
+}
+#else
+#define ADC_SCAN_IN_PLACE   0
+#endif
 #define ADC_RESOLUTION 14
 #define ADC_GAIN ADC_GAIN_1_6
 #define ADC_REFERENCE ADC_REF_INTERNAL
 #define ADC_ACQUISITION_TIME ADC_ACQ_TIME(ADC_ACQ_TIME_MICROSECONDS, 3)
-#define ADC_CHANNEL_1_ID 1
-#define ADC_CHANNEL_2_ID 2
-#define ADC_CHANNEL_3_ID 3
-#define BUFFER_SIZE 3
-
-static const float adc_max_scale = (600.0f * 6.0f) / (16383.0f);
-
-// int16_t adc_voltage[BUFFER_SIZE];
-
-static const struct adc_channel_cfg m_channel_1_cfg = {
-    .gain = ADC_GAIN,
-    .reference = ADC_REFERENCE,
-    .acquisition_time = ADC_ACQUISITION_TIME,
-    .channel_id = ADC_CHANNEL_1_ID,
-    // .differential = 1,
-    .input_positive = NRF_SAADC_INPUT_AIN0,
-    // .input_negative = NRF_SAADC_INPUT_AIN1,
-};
+#define MAX_CHANNELS GENERIC_SENSOR_ADC_MAX_CHANNELS
 
-static const struct adc_channel_cfg m_channel_2_cfg = {
-    .gain = ADC_GAIN,
-    .reference = ADC_REFERENCE,
-    .acquisition_time = ADC_ACQUISITION_TIME,
-    .channel_id = ADC_CHANNEL_2_ID,
-    // .differential = 1,
-    .input_positive = NRF_SAADC_INPUT_AIN1,
-    // .input_negative = NRF_SAADC_INPUT_AIN3,
+/*
+ * The supply is converted on the last SAADC channel as part of every
+ * scan, so it lands after the sensor channels and never interrupts their
+ * sequence. VDD is read with the sensor gain, VDDH divided by 5 on top.
+ */
+#ifdef CONFIG_GENERIC_SENSOR_ADC_SUPPLY
+#define ADC_SUPPLY          1
+#define ADC_SUPPLY_CHANNEL_ID 7
+#ifdef CONFIG_GENERIC_SENSOR_ADC_SUPPLY_VDDH
+#define ADC_SUPPLY_INPUT    NRF_SAADC_INPUT_VDDHDIV5
+#define ADC_SUPPLY_DIV      5
+#else
+#define ADC_SUPPLY_INPUT    NRF_SAADC_INPUT_VDD
+#define ADC_SUPPLY_DIV      1
+#endif
+#else
+#define ADC_SUPPLY          0
+#endif
+
+/*
+ * Every channel uses ADC_GAIN and reads the analog input of its index in
+ * the instance's channel list, AIN0 for the first.
+ */
+#define ADC_CHANNEL_INPUT(i)    (NRF_SAADC_INPUT_AIN0 + (i))
+
+/*
+ * Integer conversion
+ *
+ * Full scale in mV follows from the reference and the inverse gain:
+ * 600 mV internal reference / (1/6) = 3600 mV over 2^14 - 1 codes. The
+ * mV per code is kept as a Q16 constant so that a conversion is one
+ * multiply and one shift, with no float code pulled in.
+ */
+#define ADC_GAIN_INV_NUM(g)                                             \
+    ((g) == ADC_GAIN_1_6 ? 6 : (g) == ADC_GAIN_1_5 ? 5 :                \
+     (g) == ADC_GAIN_1_4 ? 4 : (g) == ADC_GAIN_1_3 ? 3 :                \
+     (g) == ADC_GAIN_1_2 ? 2 : 1)
+#define ADC_GAIN_INV_DEN(g)                                             \
+    ((g) == ADC_GAIN_2 ? 2 : (g) == ADC_GAIN_4 ? 4 : 1)
+/* nRF52 internal reference is 0.6 V, VDD/4 assumes a 3.3 V supply */
+#define ADC_REFERENCE_MV(r)                                             \
+    ((r) == ADC_REF_INTERNAL ? 600 : (r) == ADC_REF_VDD_1_4 ? 825 : 0)
+
+#define ADC_FULL_SCALE_MV(g) (ADC_REFERENCE_MV(ADC_REFERENCE) *         \
+                              ADC_GAIN_INV_NUM(g) / ADC_GAIN_INV_DEN(g))
+#define ADC_MAX_CODE        ((1 << ADC_RESOLUTION) - 1)
+#define ADC_SCALE_Q         16
+#define ADC_SCALE_ROUND     (1 << (ADC_SCALE_Q - 1))
+#define ADC_SCALE_Q16(g)                                                \
+    ((((int32_t)ADC_FULL_SCALE_MV(g) << ADC_SCALE_Q) + ADC_MAX_CODE / 2) / \
+     ADC_MAX_CODE)
+
+BUILD_ASSERT(GENERIC_SENSOR_ADC_CHANNELS >= 1 &&
+             GENERIC_SENSOR_ADC_CHANNELS <= MAX_CHANNELS,
+             "The SAADC scans one to eight channels");
+BUILD_ASSERT(ADC_REFERENCE_MV(ADC_REFERENCE) != 0,
+             "No millivolt value known for ADC_REFERENCE");
+/*
+ * A full-scale code less the most negative offset, times the largest
+ * scale with the largest gain correction (2), must not overflow 32 bits
+ */
+BUILD_ASSERT(((int64_t)ADC_MAX_CODE - INT16_MIN) * 2 *
+             ((((int64_t)ADC_REFERENCE_MV(ADC_REFERENCE) * 6 << ADC_SCALE_Q) /
+               ADC_MAX_CODE) + 1)
+             < INT32_MAX, "ADC_SCALE_Q too large for ADC_RESOLUTION");
+
+struct gs_adc_config {
+    const struct device *adc;
+    const uint8_t *channel_ids;
+    uint8_t channels;
+    /* sample-dividers from devicetree, fewer than channels if shorter */
+    const uint16_t *dividers;
+    uint8_t divider_count;
+    /* report-dividers, the same way */
+    const uint16_t *reports;
+    uint8_t report_count;
 };
-static const struct adc_channel_cfg m_channel_3_cfg = {
-    .gain = ADC_GAIN,
-    .reference = ADC_REFERENCE,
-    .acquisition_time = ADC_ACQUISITION_TIME,
-    .channel_id = ADC_CHANNEL_3_ID,
-    // .differential = 1,
-    .input_positive = NRF_SAADC_INPUT_AIN2,
-    // .input_negative = NRF_SAADC_INPUT_AIN5,
+
+struct gs_adc_data {
+    const struct device *dev;
+    uint32_t channel_mask;
+    /* Samples in a scan, the supply included */
+    uint8_t scan_len;
+
+    /*
+     * Scales with the per-channel gain correction folded in, and the
+     * offsets in codes that go before them. Correcting costs one
+     * subtraction.
+     */
+    int32_t scale_q16[MAX_CHANNELS];
+    int16_t offset[MAX_CHANNELS];
+
+    /* Scan taken by sensor_sample_fetch(), raw until read out */
+    int16_t sample[MAX_CHANNELS];
+
+    /*
+     * Continuous acquisition. dma_buf is where the scan in progress goes,
+     * a frame of the block being filled or, if that is not possible, scan.
+     */
+    int16_t scan[MAX_CHANNELS];
+    int16_t *dma_buf;
+    struct adc_sequence_options options;
+    struct adc_sequence sequence;
+    int16_t *blocks;
+    size_t block_frames;
+    volatile uint8_t fill_idx;
+    volatile uint8_t ready_idx;
+    volatile uint16_t fill_frames;
+    uint32_t block_time_us[2];
+    volatile bool running;
+    volatile bool stop;
+    generic_sensor_adc_block_cb_t cb;
+    struct k_work block_work;
+    /* Given when the continuous sequence has finished after a stop */
+    struct k_sem done;
+
+    /* Restart requests from other threads, see restart_on_queue() */
+    struct k_work restart_work;
+    struct k_sem restart_done;
+    struct k_mutex restart_lock;
+    bool restart_cal;
+    int restart_err;
+
+    /*
+     * Multi-rate acquisition. Frame numbers count from the start and
+     * wrap; sched_next_us is the uptime at which frame sched_next is due.
+     */
+    uint16_t divider[MAX_CHANNELS];
+    uint16_t report[MAX_CHANNELS];
+    bool multirate;
+    int16_t held[MAX_CHANNELS];
+    uint32_t sched_due[MAX_CHANNELS];
+    uint32_t sched_frame;
+    uint32_t sched_next;
+    uint64_t sched_next_us;
+    struct k_timer sched_timer;
+    struct k_work sched_work;
+
+#if ADC_SUPPLY
+    /* Supply codes since the last generic_sensor_adc_supply() */
+    uint32_t supply_sum;
+    uint16_t supply_count;
+#endif
 };
 
-void generic_sensor_adc_sample(int16_t adc_voltage[])
+/* Oversampling in generic_sensor_adc_multi_sample(), a power of two */
+#define OVERSAMPLE_SHIFT    4
+#define OVERSAMPLE_N        (1 << OVERSAMPLE_SHIFT)
+
+static inline int16_t adc_raw_to_mv(const struct gs_adc_data *data,
+                                    int32_t raw, int ch)
+{
+    return (int16_t)(((raw - data->offset[ch]) * data->scale_q16[ch] +
+                      ADC_SCALE_ROUND) >> ADC_SCALE_Q);
+}
+
+uint8_t generic_sensor_adc_channels(const struct device *dev)
+{
+    const struct gs_adc_config *config = dev->config;
+
+    return config->channels;
+}
+
+void generic_sensor_adc_set_correction(const struct device *dev, int ch,
+                                       int16_t offset, uint16_t gain_q15)
 {
-    static int err;
-    static int16_t m_sample_buffer[BUFFER_SIZE];
+    const struct gs_adc_config *config = dev->config;
+    struct gs_adc_data *data = dev->data;
 
-    if (!adc_dev) {
-        printk("Missing device\n");
+    if (ch < 0 || ch >= config->channels) {
         return;
     }
-    
-    // init the adc_voltage with zeros
-    for (int i = 0; i < BUFFER_SIZE; i++) {
-        adc_voltage[i] = 0;
+
+    data->scale_q16[ch] = (int32_t)(((int64_t)ADC_SCALE_Q16(ADC_GAIN) *
+                                     gain_q15 + (1 << 14)) >> 15);
+    data->offset[ch] = offset;
+}
+
+/* Account the supply sample that follows the channels of a scan */
+static inline void supply_add(struct gs_adc_data *data, int16_t raw)
+{
+#if ADC_SUPPLY
+    /* Halving both keeps the mean and weights older scans less */
+    if (data->supply_count == UINT16_MAX) {
+        data->supply_sum >>= 1;
+        data->supply_count >>= 1;
     }
+    data->supply_sum += MAX(raw, 0);
+    data->supply_count++;
+#endif
+}
 
+/* One scan of every channel of the instance into buf */
+static int adc_scan(const struct device *dev, int16_t *buf, bool calibrate)
+{
+    struct gs_adc_data *data = dev->data;
+    const struct gs_adc_config *config = dev->config;
     const struct adc_sequence sequence = {
-        .channels = BIT(ADC_CHANNEL_1_ID) | BIT(ADC_CHANNEL_2_ID) | BIT(ADC_CHANNEL_3_ID),
-        .buffer = m_sample_buffer,
-        .buffer_size = sizeof(m_sample_buffer),
+        .channels = data->channel_mask,
+        .buffer = buf,
+        .buffer_size = data->scan_len * sizeof(buf[0]),
         .resolution = ADC_RESOLUTION,
-        .calibrate = 1,
+        .calibrate = calibrate,
     };
-        
-    err = adc_read(adc_dev, &sequence);
+    uint32_t start;
+    int err;
+
+    /* The continuous sequence owns the SAADC while it runs */
+    if (data->running) {
+        return -EBUSY;
+    }
+
+    start = generic_sensor_metrics_start();
+    err = adc_read(config->adc, &sequence);
+    generic_sensor_metrics_stage(GENERIC_SENSOR_STAGE_ADC, start);
+
+    if (!err && !calibrate) {
+        unsigned int key = irq_lock();
+
+        supply_add(data, buf[config->channels]);
+        irq_unlock(key);
+    }
+
+    return err;
+}
+
+void generic_sensor_adc_sample(const struct device *dev, int16_t adc_voltage[])
+{
+    int16_t raw[MAX_CHANNELS] = { 0 };
+    int err;
+
+    err = adc_scan(dev, raw, false);
     if (err) {
-        printk("Error in adc sampling: %d\n", err);
+        LOG_ERR("Error in adc sampling: %d", err);
     }
-    
-    // Convert the values
-    for (int i = 0; i < BUFFER_SIZE; i++) {
-        /*
-         2^11 = 2048
-         2^12 = 4096
-         2^13 = 8192
-         2^14 = 16384
-         */
-        adc_voltage[i] = (int)((float)m_sample_buffer[i] * adc_max_scale);
-        // Print the values adc_max_scale
-        // printf("scale: %2.20f \n", adc_max_scale); //0,21973997436366965757187328328145
-        // printf("dif: %f \n", adc_max_scale - 0.21973997436366965757187328328145f);
-        // printk("ADC raw value: %d \n", m_sample_buffer[i]);
-        // printk("Estimated voltage: %d mV\n", adc_voltage[i]);
+    generic_sensor_metrics_count(GENERIC_SENSOR_CNT_SAMPLES, 1);
+
+    generic_sensor_adc_convert(dev, raw, adc_voltage);
+}
+
+void generic_sensor_adc_multi_sample(const struct device *dev,
+                                     int16_t adc_voltage[])
+{
+    const struct gs_adc_config *config = dev->config;
+    struct gs_adc_data *data = dev->data;
+    int16_t raw[MAX_CHANNELS];
+    int32_t cum[MAX_CHANNELS] = { 0 };
+    uint32_t loop_start = generic_sensor_metrics_start();
+    int err;
+
+    for (int i = 0; i < OVERSAMPLE_N; i++) {
+        err = adc_scan(dev, raw, false);
+        if (err) {
+            LOG_ERR("Error in adc sampling: %d", err);
+            memset(raw, 0, sizeof(raw));
+        }
+
+        for (int j = 0; j < config->channels; j++) {
+            cum[j] = cum[j] + raw[j];
+        }
+    }
+
+    generic_sensor_metrics_stage(GENERIC_SENSOR_STAGE_OVERSAMPLE, loop_start);
+    generic_sensor_metrics_count(GENERIC_SENSOR_CNT_SAMPLES, OVERSAMPLE_N);
+
+    for (int i = 0; i < config->channels; i++) {
+        adc_voltage[i] = adc_raw_to_mv(
+            data, generic_sensor_div_round(cum[i], OVERSAMPLE_N), i);
+        LOG_DBG("Estimated voltage: %d mV", adc_voltage[i]);
+    }
+}
+
+void generic_sensor_adc_convert(const struct device *dev, const int16_t raw[],
+                                int16_t adc_voltage[])
+{
+    generic_sensor_adc_convert_block(dev, raw, adc_voltage, 1);
+}
+
+void generic_sensor_adc_convert_block(const struct device *dev,
+                                      const int16_t *raw, int16_t *adc_voltage,
+                                      size_t frames)
+{
+    const struct gs_adc_config *config = dev->config;
+    const struct gs_adc_data *data = dev->data;
+    const int channels = config->channels;
+
+    /* Frames are interleaved */
+    for (size_t i = 0; i < frames; i++) {
+        for (int j = 0; j < channels; j++) {
+            adc_voltage[j] = adc_raw_to_mv(data, raw[j], j);
+        }
+        raw += channels;
+        adc_voltage += channels;
     }
 }
 
-void generic_sensor_adc_multi_sample(int16_t adc_voltage[])
+void generic_sensor_adc_block_average(const struct device *dev,
+                                      const int16_t *block, size_t frames,
+                                      int16_t adc_voltage[])
 {
-    static int err;
-    static int16_t m_sample_buffer[BUFFER_SIZE];
-    static int32_t cum[BUFFER_SIZE];
-    static const int16_t oversample_N = 20;
+    const struct gs_adc_config *config = dev->config;
+    const struct gs_adc_data *data = dev->data;
+    int32_t cum[MAX_CHANNELS] = { 0 };
 
-    if (!adc_dev) {
-        printk("Missing device\n");
+    if (!frames) {
         return;
     }
-    
-    // init the adc_voltage with zeros
-    for (int i = 0; i < BUFFER_SIZE; i++) {
-        adc_voltage[i] = 0;
-        cum[i] = 0;
+
+    for (size_t i = 0; i < frames; i++) {
+        for (int j = 0; j < config->channels; j++) {
+            cum[j] = cum[j] + block[i * config->channels + j];
+        }
     }
 
-    const struct adc_sequence sequence = {
-        .channels = BIT(ADC_CHANNEL_1_ID) | BIT(ADC_CHANNEL_2_ID) | BIT(ADC_CHANNEL_3_ID),
-        .buffer = m_sample_buffer,
-        .buffer_size = sizeof(m_sample_buffer),
+    for (int i = 0; i < config->channels; i++) {
+        adc_voltage[i] = adc_raw_to_mv(
+            data, generic_sensor_div_round(cum[i], frames), i);
+    }
+}
+
+/*
+ * Continuous acquisition
+ *
+ * The sequence is started once with adc_read_async() and re-armed by the
+ * driver's interval timer. The callback answers ADC_ACTION_REPEAT, which
+ * leaves the DMA pointer alone, and hands a full block to the sampling
+ * work queue while the other block keeps filling. The work queue is
+ * shared by all instances.
+ *
+ * On the nRF SAADC the callback moves the DMA pointer to the next frame
+ * of the block itself, so every scan lands where the consumer reads it.
+ * The pointer is latched by the next START, which the interval timer only
+ * triggers after the callback has returned. A supply sample spills into
+ * the next frame, which the following scan overwrites; only the last
+ * frame of the second block has no room for it and goes through the scan
+ * buffer. Other ADCs always convert into the scan buffer, which is copied
+ * into the block.
+ */
+#define SAMPLING_WORKQ_STACK_SIZE   1024
+#define SAMPLING_WORKQ_PRIORITY     K_PRIO_PREEMPT(1)
+
+static K_THREAD_STACK_DEFINE(m_workq_stack, SAMPLING_WORKQ_STACK_SIZE);
+static struct k_work_q m_workq;
+
+static void block_work_handler(struct k_work *work)
+{
+    struct gs_adc_data *data = CONTAINER_OF(work, struct gs_adc_data,
+                                            block_work);
+    const struct gs_adc_config *config = data->dev->config;
+    generic_sensor_adc_block_cb_t cb = data->cb;
+    uint8_t idx = data->ready_idx;
+
+    if (cb) {
+        cb(data->dev, &data->blocks[idx * data->block_frames *
+                                    config->channels],
+           data->block_frames, data->block_time_us[idx]);
+    }
+}
+
+/*
+ * Where the next scan goes: its frame of the block being filled, or the
+ * scan buffer for the last frame of the second block, whose supply sample
+ * would run past the end
+ */
+static int16_t *dma_target(struct gs_adc_data *data)
+{
+    const struct gs_adc_config *config = data->dev->config;
+
+    if (!ADC_SCAN_IN_PLACE ||
+        (ADC_SUPPLY && data->fill_idx == 1 &&
+         data->fill_frames == data->block_frames - 1)) {
+        return data->scan;
+    }
+
+    return &data->blocks[(data->fill_idx * data->block_frames +
+                          data->fill_frames) * config->channels];
+}
+
+/* Count a frame into the block being filled, true if that completed it */
+static bool frame_added(struct gs_adc_data *data)
+{
+    generic_sensor_metrics_count(GENERIC_SENSOR_CNT_SAMPLES, 1);
+
+    if (++data->fill_frames < data->block_frames) {
+        return false;
+    }
+
+    data->ready_idx = data->fill_idx;
+    data->fill_idx ^= 1;
+    data->fill_frames = 0;
+
+    return true;
+}
+
+static enum adc_action continuous_sample_cb(const struct device *adc,
+                                            const struct adc_sequence *sequence,
+                                            uint16_t sampling_index)
+{
+    struct gs_adc_data *data = sequence->options->user_data;
+    const struct gs_adc_config *config = data->dev->config;
+    uint32_t start = generic_sensor_metrics_start();
+    int16_t *frame = &data->blocks[(data->fill_idx * data->block_frames +
+                                    data->fill_frames) * config->channels];
+
+    if (data->dma_buf != frame) {
+        memcpy(frame, data->dma_buf, config->channels * sizeof(frame[0]));
+        generic_sensor_metrics_count(GENERIC_SENSOR_CNT_COPIES, 1);
+    }
+    supply_add(data, data->dma_buf[config->channels]);
+
+    if (frame_added(data)) {
+        /* Captured in the conversion callback, before any queueing */
+        data->block_time_us[data->ready_idx] =
+            (uint32_t)generic_sensor_time_now_us();
+        k_work_submit_to_queue(&m_workq, &data->block_work);
+    }
+
+#if ADC_SCAN_IN_PLACE
+    data->dma_buf = dma_target(data);
+    saadc_dma_set(data->dma_buf);
+#endif
+
+    generic_sensor_metrics_stage(GENERIC_SENSOR_STAGE_ADC, start);
+
+    if (data->stop) {
+        data->running = false;
+        k_sem_give(&data->done);
+        return ADC_ACTION_FINISH;
+    }
+
+    return ADC_ACTION_REPEAT;
+}
+
+/*
+ * Multi-rate acquisition
+ *
+ * Once a channel is sampled less often than every frame, the continuous
+ * sequence gives way to a deadline scheduler on the sampling work queue.
+ * Channel i is due every divider[i] frames. The timer is programmed for
+ * the earliest deadline only, and every channel due at that frame is
+ * converted in one scan of just those channels, so slow channels cost
+ * nothing in between and coinciding deadlines share a conversion. The
+ * frame grid is kept: channels that were not due hold their last value,
+ * and the frames before a deadline, which could only repeat held values,
+ * are written when it is reached instead of waking up for each of them.
+ */
+static void sched_timer_expired(struct k_timer *timer)
+{
+    struct gs_adc_data *data = CONTAINER_OF(timer, struct gs_adc_data,
+                                            sched_timer);
+
+    k_work_submit_to_queue(&m_workq, &data->sched_work);
+}
+
+/* Copy the held values into the block as the next frame */
+static void sched_put(struct gs_adc_data *data, uint32_t timestamp_us)
+{
+    const struct gs_adc_config *config = data->dev->config;
+
+    memcpy(&data->blocks[(data->fill_idx * data->block_frames +
+                          data->fill_frames) * config->channels],
+           data->held, config->channels * sizeof(data->held[0]));
+    generic_sensor_metrics_count(GENERIC_SENSOR_CNT_COPIES, 1);
+    data->sched_frame++;
+
+    if (frame_added(data)) {
+        data->block_time_us[data->ready_idx] = timestamp_us;
+        /*
+         * Already on the sampling work queue. Handing the block on now
+         * keeps it from being overwritten by a long run of held frames.
+         */
+        block_work_handler(&data->block_work);
+    }
+}
+
+static void sched_work_handler(struct k_work *work)
+{
+    struct gs_adc_data *data = CONTAINER_OF(work, struct gs_adc_data,
+                                            sched_work);
+    const struct gs_adc_config *config = data->dev->config;
+    const uint32_t interval_us = data->options.interval_us;
+    const uint32_t frame = data->sched_next;
+    struct adc_sequence sequence = {
+        .buffer = data->scan,
         .resolution = ADC_RESOLUTION,
-        .calibrate = 1,
     };
-    
-    for (int i = 0; i < oversample_N; i++) {
-        // printk("iteration: %d\n", i);
-    
-        err = adc_read(adc_dev, &sequence);
-        if (err) {
-            printk("Error in adc sampling: %d\n", err);
+    uint32_t now_us;
+    uint32_t start;
+    uint32_t next;
+    uint8_t due = 0;
+    unsigned int key;
+    int n = 0;
+    int err;
+
+    if (!data->running) {
+        return;
+    }
+
+    if (data->stop) {
+        /* The timer may have been re-armed since sched_stop() */
+        k_timer_stop(&data->sched_timer);
+        data->running = false;
+        k_sem_give(&data->done);
+        return;
+    }
+
+    now_us = (uint32_t)generic_sensor_time_now_us();
+
+    /* Frames without a deadline repeat what is held */
+    while (data->sched_frame != frame) {
+        sched_put(data, now_us - (frame - data->sched_frame) * interval_us);
+    }
+
+    for (int i = 0; i < config->channels; i++) {
+        if (data->sched_due[i] == frame) {
+            due |= BIT(i);
+            sequence.channels |= BIT(config->channel_ids[i]);
+            data->sched_due[i] += data->divider[i];
+            n++;
+        }
+    }
+#if ADC_SUPPLY
+    sequence.channels |= BIT(ADC_SUPPLY_CHANNEL_ID);
+    n++;
+#endif
+    sequence.buffer_size = n * sizeof(data->scan[0]);
+
+    start = generic_sensor_metrics_start();
+    err = adc_read(config->adc, &sequence);
+    generic_sensor_metrics_stage(GENERIC_SENSOR_STAGE_ADC, start);
+
+    if (err) {
+        LOG_ERR("Error in adc sampling: %d", err);
+    } else {
+        /* Stored in channel order, the supply last */
+        n = 0;
+        for (int i = 0; i < config->channels; i++) {
+            if (due & BIT(i)) {
+                data->held[i] = data->scan[n++];
+            }
         }
 
-        for (int j = 0; j < BUFFER_SIZE; j++) {
-            cum[j] = cum[j] + m_sample_buffer[j];
-            // printk("cumulated value: %d \n", cum[j]);
-            // printk("buffer: %d mV\n", m_sample_buffer[j]);
+        key = irq_lock();
+        supply_add(data, data->scan[n]);
+        irq_unlock(key);
+    }
+
+    sched_put(data, now_us);
+
+    /* Earliest deadline, frame numbers compared across the wrap */
+    next = data->sched_due[0];
+    for (int i = 1; i < config->channels; i++) {
+        if ((int32_t)(data->sched_due[i] - next) < 0) {
+            next = data->sched_due[i];
         }
     }
-        
-    // Convert the values
-    for (int i = 0; i < BUFFER_SIZE; i++) {
-        /*
-        2^11 = 2048
-        2^12 = 4096
-        2^13 = 8192
-        2^14 = 16384
-        */
-        adc_voltage[i] = (int)(( (float)cum[i] / (float)oversample_N) * adc_max_scale);
-        // Print the values
-        // printk("cumulated value: %d \n", cum[i]);
-        printk("Estimated voltage: %d mV\n", adc_voltage[i]);
+
+    data->sched_next_us += (uint64_t)(next - frame) * interval_us;
+    data->sched_next = next;
+    k_timer_start(&data->sched_timer, K_TIMEOUT_ABS_US(data->sched_next_us),
+                  K_NO_WAIT);
+}
+
+/* Have the scheduler act on a stop now rather than at the next deadline */
+static void sched_stop(struct gs_adc_data *data)
+{
+    k_timer_stop(&data->sched_timer);
+    k_work_submit_to_queue(&m_workq, &data->sched_work);
+}
+
+static int sched_start(struct gs_adc_data *data)
+{
+    const struct gs_adc_config *config = data->dev->config;
+
+    for (int i = 0; i < config->channels; i++) {
+        data->sched_due[i] = 0;
     }
+    data->sched_frame = 0;
+    data->sched_next = 0;
+    data->sched_next_us = k_ticks_to_us_ceil64(k_uptime_ticks());
+
+    k_work_submit_to_queue(&m_workq, &data->sched_work);
 
+    return 0;
 }
 
-int generic_sensor_adc_init(void)
+/* Upper bound for the continuous sequence to notice a stop */
+#define CONT_STOP_TIMEOUT   K_MSEC(100)
+
+int generic_sensor_adc_start(const struct device *dev, uint32_t interval_us,
+                             int16_t *blocks, size_t frames,
+                             generic_sensor_adc_block_cb_t cb)
 {
+    const struct gs_adc_config *config = dev->config;
+    struct gs_adc_data *data = dev->data;
+    unsigned int key;
     int err;
 
-    printk("nRF52 SAADC sampling 3 channels AIN0 AIN1 AIN2\n");
+    if (!frames) {
+        return -EINVAL;
+    }
 
-    adc_dev = device_get_binding("ADC_0");
-    if (!adc_dev) {
-        printk("device_get_binding ADC_0 failed\n");
-        return -1;
+    /* The scheduler finishes a stop right away, let it */
+    if (data->multirate && data->running && data->stop) {
+        k_sem_take(&data->done, CONT_STOP_TIMEOUT);
     }
-    // Config ADC
-    err = adc_channel_setup(adc_dev, &m_channel_1_cfg);
-    if (err) {
-        printk("Error in adc setup 1 : %d\n", err);
-        return -1;
+
+    /* A stop that the callback has not acted on yet is simply cancelled */
+    key = irq_lock();
+    if (data->running && data->blocks == blocks &&
+        data->block_frames == frames) {
+        data->stop = false;
+        data->cb = cb;
+        irq_unlock(key);
+        return 0;
     }
+    irq_unlock(key);
 
-    err = adc_channel_setup(adc_dev, &m_channel_2_cfg);
+    if (data->running) {
+        return -EBUSY;
+    }
+
+    /*
+     * A restart on the same buffers goes on filling the same half: the
+     * other one may still be queued for the block callback
+     */
+    if (data->blocks != blocks || data->block_frames != frames) {
+        data->fill_idx = 0;
+    }
+    data->blocks = blocks;
+    data->block_frames = frames;
+    data->cb = cb;
+    data->fill_frames = 0;
+    data->stop = false;
+    data->options.interval_us = interval_us;
+    data->running = true;
+    k_sem_reset(&data->done);
+
+    data->multirate = false;
+    for (int i = 0; i < config->channels; i++) {
+        data->multirate |= data->divider[i] > 1;
+    }
+    if (data->multirate) {
+        return sched_start(data);
+    }
+
+    data->dma_buf = dma_target(data);
+    data->sequence.buffer = data->dma_buf;
+
+    err = adc_read_async(config->adc, &data->sequence, NULL);
     if (err) {
-        printk("Error in adc setup 2: %d\n", err);
-        return -1;
+        data->running = false;
+        LOG_ERR("Error starting continuous sampling: %d", err);
+        return err;
+    }
+
+    return 0;
+}
+
+void generic_sensor_adc_stop(const struct device *dev)
+{
+    struct gs_adc_data *data = dev->data;
+
+    data->stop = true;
+    if (data->multirate) {
+        sched_stop(data);
+    }
+}
+
+/*
+ * Stop a running stream, optionally calibrate, and start it again with
+ * the current dividers. Runs on the sampling work queue, so no block
+ * callback or scheduler deadline is in progress. The driver keeps the
+ * calibrate flag of a sequence for every repetition, so the continuous
+ * sequence never carries it: calibration is a one-shot scan of its own
+ * while the stream is stopped.
+ */
+static int restart_on_queue(const struct device *dev, bool calibrate)
+{
+    struct gs_adc_data *data = dev->data;
+    int16_t scratch[MAX_CHANNELS];
+    bool restart;
+    unsigned int key;
+    int err;
+
+    key = irq_lock();
+    restart = data->running && !data->stop;
+    data->stop = data->running;
+    irq_unlock(key);
+
+    if (data->running && data->multirate) {
+        /* The scheduler runs on this queue, it is between deadlines */
+        k_timer_stop(&data->sched_timer);
+        k_work_cancel(&data->sched_work);
+        data->running = false;
+        k_sem_give(&data->done);
+    } else if (data->running && k_sem_take(&data->done, CONT_STOP_TIMEOUT)) {
+        /* The continuous sequence owns the SAADC until it has finished */
+        return -EBUSY;
+    }
+
+    if (calibrate) {
+        err = adc_scan(dev, scratch, true);
+        if (err) {
+            return err;
+        }
+    }
+
+    if (!restart) {
+        return 0;
+    }
+
+    return generic_sensor_adc_start(dev, data->options.interval_us,
+                                   data->blocks, data->block_frames,
+                                   data->cb);
+}
+
+static void restart_work_handler(struct k_work *work)
+{
+    struct gs_adc_data *data = CONTAINER_OF(work, struct gs_adc_data,
+                                            restart_work);
+
+    data->restart_err = restart_on_queue(data->dev, data->restart_cal);
+    k_sem_give(&data->restart_done);
+}
+
+/* restart_on_queue() from any thread, waiting for its result */
+static int restart_stream(const struct device *dev, bool calibrate)
+{
+    struct gs_adc_data *data = dev->data;
+    int err;
+
+    if (k_current_get() == &m_workq.thread) {
+        return restart_on_queue(dev, calibrate);
+    }
+
+    k_mutex_lock(&data->restart_lock, K_FOREVER);
+    data->restart_cal = calibrate;
+    k_work_submit_to_queue(&m_workq, &data->restart_work);
+    k_sem_take(&data->restart_done, K_FOREVER);
+    err = data->restart_err;
+    k_mutex_unlock(&data->restart_lock);
+
+    return err;
+}
+
+int generic_sensor_adc_calibrate(const struct device *dev)
+{
+    return restart_stream(dev, true);
+}
+
+int generic_sensor_adc_set_divider(const struct device *dev, int ch,
+                                   uint16_t divider)
+{
+    const struct gs_adc_config *config = dev->config;
+    struct gs_adc_data *data = dev->data;
+
+    if (ch < 0 || ch >= config->channels || !divider) {
+        return -EINVAL;
+    }
+
+    data->divider[ch] = divider;
+
+    /* Switches between the continuous sequence and the scheduler */
+    return restart_stream(dev, false);
+}
+
+uint16_t generic_sensor_adc_divider(const struct device *dev, int ch)
+{
+    const struct gs_adc_config *config = dev->config;
+    const struct gs_adc_data *data = dev->data;
+
+    if (ch < 0 || ch >= config->channels) {
+        return 0;
+    }
+
+    return data->divider[ch];
+}
+
+int generic_sensor_adc_set_report_divider(const struct device *dev, int ch,
+                                          uint16_t divider)
+{
+    const struct gs_adc_config *config = dev->config;
+    struct gs_adc_data *data = dev->data;
+
+    if (ch < 0 || ch >= config->channels || !divider) {
+        return -EINVAL;
+    }
+
+    data->report[ch] = divider;
+
+    return 0;
+}
+
+uint16_t generic_sensor_adc_report_divider(const struct device *dev, int ch)
+{
+    const struct gs_adc_config *config = dev->config;
+    const struct gs_adc_data *data = dev->data;
+
+    if (ch < 0 || ch >= config->channels) {
+        return 0;
+    }
+
+    return data->report[ch];
+}
+
+struct k_work_q *generic_sensor_adc_workq(void)
+{
+    return &m_workq;
+}
+
+#if ADC_SUPPLY
+int generic_sensor_adc_supply(const struct device *dev, uint16_t *mv)
+{
+    struct gs_adc_data *data = dev->data;
+    int16_t scratch[MAX_CHANNELS];
+    uint32_t sum;
+    uint16_t count;
+    unsigned int key;
+    int err;
+
+    /* Idle: take a scan of its own, a running stream brings plenty */
+    if (!data->supply_count && !data->running) {
+        err = adc_scan(dev, scratch, false);
+        if (err) {
+            return err;
+        }
+    }
+
+    key = irq_lock();
+    sum = data->supply_sum;
+    count = data->supply_count;
+    data->supply_sum = 0;
+    data->supply_count = 0;
+    irq_unlock(key);
+
+    if (!count) {
+        return -EAGAIN;
+    }
+
+    /* No calibration correction, the supply is not a sensor channel */
+    *mv = (uint16_t)(((int64_t)generic_sensor_div_round(sum, count) *
+                      ADC_SUPPLY_DIV * ADC_SCALE_Q16(ADC_GAIN) +
+                      ADC_SCALE_ROUND) >> ADC_SCALE_Q);
+
+    return 0;
+}
+#endif
+
+/* Sensor API: single frames, converted only when read out */
+
+static int gs_adc_sample_fetch(const struct device *dev,
+                               enum sensor_channel chan)
+{
+    struct gs_adc_data *data = dev->data;
+    int err;
+
+    if (chan != SENSOR_CHAN_ALL && chan != SENSOR_CHAN_VOLTAGE) {
+        return -ENOTSUP;
+    }
+
+    err = adc_scan(dev, data->sample, false);
+    if (!err) {
+        generic_sensor_metrics_count(GENERIC_SENSOR_CNT_SAMPLES, 1);
     }
 
-    err = adc_channel_setup(adc_dev, &m_channel_3_cfg);
+    return err;
+}
+
+static void mv_to_sensor_value(int16_t mv, struct sensor_value *val)
+{
+    val->val1 = mv / 1000;
+    val->val2 = (mv % 1000) * 1000;
+}
+
+static int gs_adc_channel_get(const struct device *dev,
+                              enum sensor_channel chan,
+                              struct sensor_value *val)
+{
+    const struct gs_adc_config *config = dev->config;
+    const struct gs_adc_data *data = dev->data;
+    int first = 0;
+    int count = config->channels;
+
+    if (chan != SENSOR_CHAN_VOLTAGE) {
+        first = (int)chan - SENSOR_CHAN_PRIV_START;
+        count = 1;
+        if (first < 0 || first >= config->channels) {
+            return -ENOTSUP;
+        }
+    }
+
+    for (int i = 0; i < count; i++) {
+        mv_to_sensor_value(adc_raw_to_mv(data, data->sample[first + i],
+                                         first + i), &val[i]);
+    }
+
+    return 0;
+}
+
+static const struct sensor_driver_api gs_adc_api = {
+    .sample_fetch = gs_adc_sample_fetch,
+    .channel_get = gs_adc_channel_get,
+};
+
+static int gs_adc_init(const struct device *dev)
+{
+    static bool workq_started;
+    const struct gs_adc_config *config = dev->config;
+    struct gs_adc_data *data = dev->data;
+    int err;
+
+    if (!device_is_ready(config->adc)) {
+        LOG_ERR("%s: ADC %s not ready", dev->name, config->adc->name);
+        return -ENODEV;
+    }
+
+    /* Device init runs once per instance, one after the other */
+    if (!workq_started) {
+        k_work_queue_start(&m_workq, m_workq_stack,
+                           K_THREAD_STACK_SIZEOF(m_workq_stack),
+                           SAMPLING_WORKQ_PRIORITY, NULL);
+        k_thread_name_set(&m_workq.thread, "gs_adc");
+        workq_started = true;
+    }
+
+    data->dev = dev;
+    data->channel_mask = 0;
+
+    for (int i = 0; i < config->channels; i++) {
+        const struct adc_channel_cfg cfg = {
+            .gain = ADC_GAIN,
+            .reference = ADC_REFERENCE,
+            .acquisition_time = ADC_ACQUISITION_TIME,
+            .channel_id = config->channel_ids[i],
+#ifdef CONFIG_ADC_CONFIGURABLE_INPUTS
+            .input_positive = ADC_CHANNEL_INPUT(i),
+#endif
+        };
+
+        err = adc_channel_setup(config->adc, &cfg);
+        if (err) {
+            LOG_ERR("Error in adc setup %d: %d", cfg.channel_id, err);
+            return err;
+        }
+
+        data->channel_mask |= BIT(cfg.channel_id);
+        generic_sensor_adc_set_correction(dev, i, 0, 32768);
+        data->divider[i] = i < config->divider_count && config->dividers[i] ?
+                           config->dividers[i] : 1;
+        data->report[i] = i < config->report_count && config->reports[i] ?
+                          config->reports[i] : 1;
+    }
+    data->scan_len = config->channels;
+
+#if ADC_SUPPLY
+    /* Results are stored in channel order, the supply must come last */
+    if (data->channel_mask >= BIT(ADC_SUPPLY_CHANNEL_ID)) {
+        LOG_ERR("%s: channel %d is taken by the supply", dev->name,
+                ADC_SUPPLY_CHANNEL_ID);
+        return -EINVAL;
+    }
+
+    err = adc_channel_setup(config->adc, &(const struct adc_channel_cfg) {
+        .gain = ADC_GAIN,
+        .reference = ADC_REFERENCE,
+        .acquisition_time = ADC_ACQUISITION_TIME,
+        .channel_id = ADC_SUPPLY_CHANNEL_ID,
+        .input_positive = ADC_SUPPLY_INPUT,
+    });
     if (err) {
-        printk("Error in adc setup 3: %d\n", err);
-        return -1;
-    }
-
-    /* Trigger offset calibration
-    * As this generates a _DONE and _RESULT event
-    * the first result will be incorrect.
-    */
-    NRF_SAADC->TASKS_CALIBRATEOFFSET = 1;
-    int16_t values[3];
-    printk("Calibration triggered, first value will be incorrect.\n");
-    generic_sensor_adc_sample(values);
-    // while (1) {
-    //     static int * values;
-    //     values = generic_sensor_adc_sample();
-
-    //     /* Print the received values */
-    //     for (int i = 0; i < BUFFER_SIZE; i++) {
-    //         printf("received value: %i mV\n", values[i]);
-    //     }
-    //     printk("*** *** *** *** *** *** *** *** *** ***\n\n");
-    //     k_sleep(K_MSEC(50));
-    // }
+        LOG_ERR("Error in supply adc setup: %d", err);
+        return err;
+    }
+
+    data->channel_mask |= BIT(ADC_SUPPLY_CHANNEL_ID);
+    data->scan_len++;
+#endif
+
+    data->options.callback = continuous_sample_cb;
+    data->options.user_data = data;
+    data->sequence.options = &data->options;
+    data->sequence.channels = data->channel_mask;
+    data->sequence.buffer = data->scan;
+    data->sequence.buffer_size = data->scan_len * sizeof(data->scan[0]);
+    data->sequence.resolution = ADC_RESOLUTION;
+
+    k_work_init(&data->block_work, block_work_handler);
+    k_work_init(&data->sched_work, sched_work_handler);
+    k_work_init(&data->restart_work, restart_work_handler);
+    k_sem_init(&data->restart_done, 0, 1);
+    k_mutex_init(&data->restart_lock);
+    k_timer_init(&data->sched_timer, sched_timer_expired, NULL);
+    k_sem_init(&data->done, 0, 1);
+
+    /* Offset calibration is left to the calibration manager */
+    LOG_INF("%s: SAADC sampling %d channels", dev->name, config->channels);
+
     return 0;
 }
 
+#define GS_ADC_DT_CHANNEL_ID(node_id, prop, idx)                        \
+    DT_IO_CHANNELS_INPUT_BY_IDX(node_id, idx),
+
+#define GS_ADC_DEFINE(inst)                                             \
+    static const uint8_t gs_adc_channel_ids_##inst[] = {                \
+        DT_FOREACH_PROP_ELEM(DT_DRV_INST(inst), io_channels,            \
+                             GS_ADC_DT_CHANNEL_ID)                      \
+    };                                                                  \
+    BUILD_ASSERT(ARRAY_SIZE(gs_adc_channel_ids_##inst) <= MAX_CHANNELS, \
+                 "The SAADC scans one to eight channels");              \
+    static const uint16_t gs_adc_dividers_##inst[] =                    \
+        DT_INST_PROP_OR(inst, sample_dividers, { 1 });                  \
+    static const uint16_t gs_adc_reports_##inst[] =                     \
+        DT_INST_PROP_OR(inst, report_dividers, { 1 });                  \
+    static const struct gs_adc_config gs_adc_config_##inst = {          \
+        .adc = DEVICE_DT_GET(DT_INST_IO_CHANNELS_CTLR(inst)),           \
+        .channel_ids = gs_adc_channel_ids_##inst,                       \
+        .channels = ARRAY_SIZE(gs_adc_channel_ids_##inst),              \
+        .dividers = gs_adc_dividers_##inst,                             \
+        .divider_count = ARRAY_SIZE(gs_adc_dividers_##inst),            \
+        .reports = gs_adc_reports_##inst,                               \
+        .report_count = ARRAY_SIZE(gs_adc_reports_##inst),              \
+    };                                                                  \
+    static struct gs_adc_data gs_adc_data_##inst;                       \
+    DEVICE_DT_INST_DEFINE(inst, gs_adc_init, NULL,                      \
+                          &gs_adc_data_##inst, &gs_adc_config_##inst,   \
+                          POST_KERNEL, CONFIG_SENSOR_INIT_PRIORITY,     \
+                          &gs_adc_api);
+
+DT_INST_FOREACH_STATUS_OKAY(GS_ADC_DEFINE)
+
+#if !DT_HAS_COMPAT_STATUS_OKAY(DT_DRV_COMPAT)
+/* Boards that only describe the channel table, or not even that */
+#if DT_NODE_HAS_PROP(GENERIC_SENSOR_ADC_NODE, io_channels)
+#define GS_ADC_DEFAULT_CTLR     DT_IO_CHANNELS_CTLR(GENERIC_SENSOR_ADC_NODE)
+#else
+#define GS_ADC_DEFAULT_CTLR     DT_NODELABEL(adc)
+#endif
+
+#define GS_ADC_DEFAULT_CHANNEL_ID(i, _) GENERIC_SENSOR_ADC_CHANNEL_ID(i),
+
+static const uint8_t gs_adc_channel_ids_default[] = {
+    UTIL_LISTIFY(GENERIC_SENSOR_ADC_CHANNELS, GS_ADC_DEFAULT_CHANNEL_ID, _)
+};
+
+static const struct gs_adc_config gs_adc_config_default = {
+    .adc = DEVICE_DT_GET(GS_ADC_DEFAULT_CTLR),
+    .channel_ids = gs_adc_channel_ids_default,
+    .channels = GENERIC_SENSOR_ADC_CHANNELS,
+};
+
+static struct gs_adc_data gs_adc_data_default;
+
+DEVICE_DEFINE(generic_sensor_adc, "GENERIC_SENSOR_ADC", gs_adc_init, NULL,
+              &gs_adc_data_default, &gs_adc_config_default,
+              POST_KERNEL, CONFIG_SENSOR_INIT_PRIORITY, &gs_adc_api);
+#endif
+
+#ifdef CONFIG_GENERIC_SENSOR_ADC_SHELL
+#include <shell/shell.h>
+#include <stdlib.h>
+
+/* A whole number in min..max, or an error printed and false */
+static bool parse_arg(const struct shell *shell, const char *name,
+                      const char *arg, long min, long max, long *value)
+{
+    char *end;
+
+    *value = strtol(arg, &end, 0);
+    if (end == arg || *end || *value < min || *value > max) {
+        shell_error(shell, "%s must be %ld..%ld", name, min, max);
+        return false;
+    }
+
+    return true;
+}
+
+typedef int (*set_divider_t)(const struct device *dev, int ch,
+                             uint16_t divider);
+typedef uint16_t (*get_divider_t)(const struct device *dev, int ch);
+
+/* Print every channel's divider, or set one with <ch> <divider> */
+static int divider_cmd(const struct shell *shell, size_t argc, char **argv,
+                       get_divider_t get, set_divider_t set)
+{
+    const struct device *dev = GENERIC_SENSOR_ADC_DEVICE;
+    long ch, divider;
+    int err;
+
+    if (argc == 1) {
+        for (int i = 0; i < GENERIC_SENSOR_ADC_CHANNELS; i++) {
+            shell_print(shell, "ch%d divider %u", i, get(dev, i));
+        }
+        return 0;
+    }
+
+    if (argc != 3) {
+        shell_error(shell, "usage: %s [<ch> <divider>]", argv[0]);
+        return -EINVAL;
+    }
+
+    if (!parse_arg(shell, "ch", argv[1], 0,
+                   GENERIC_SENSOR_ADC_CHANNELS - 1, &ch) ||
+        !parse_arg(shell, "divider", argv[2], 1, UINT16_MAX, &divider)) {
+        return -EINVAL;
+    }
+
+    err = set(dev, ch, divider);
+    if (err) {
+        shell_error(shell, "failed (err %d)", err);
+    }
+
+    return err;
+}
+
+static int cmd_adc_divider(const struct shell *shell, size_t argc,
+                           char **argv)
+{
+    return divider_cmd(shell, argc, argv, generic_sensor_adc_divider,
+                       generic_sensor_adc_set_divider);
+}
+
+static int cmd_adc_report(const struct shell *shell, size_t argc,
+                          char **argv)
+{
+    return divider_cmd(shell, argc, argv, generic_sensor_adc_report_divider,
+                       generic_sensor_adc_set_report_divider);
+}
+
+SHELL_STATIC_SUBCMD_SET_CREATE(sub_adc,
+    SHELL_CMD_ARG(divider, NULL, "[<ch> <divider>]  Print or set the "
+                  "per-channel sample dividers", cmd_adc_divider, 1, 2),
+    SHELL_CMD_ARG(report, NULL, "[<ch> <divider>]  Print or set the "
+                  "per-channel report dividers", cmd_adc_report, 1, 2),
+    SHELL_SUBCMD_SET_END
+);
+
+SHELL_CMD_REGISTER(sensor_adc, &sub_adc, "Sensor ADC", NULL);
+#endif
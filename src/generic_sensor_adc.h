@@ -4,15 +4,169 @@
  * SPDX-License-Identifier: LicenseRef-BSD-5-Clause-Nordic
  */
 
+#include <stddef.h>
 #include <stdint.h>
+#include <devicetree.h>
+#include <device.h>
+#include <drivers/sensor.h>
 
 #ifndef GENERIC_SENSOR_ADC__H
 #define GENERIC_SENSOR_ADC__H
 
-void generic_sensor_adc_sample(int16_t adc_voltage[]);
-void generic_sensor_adc_multi_sample(int16_t adc_voltage[]);
-int generic_sensor_adc_init(void);
+/*
+ * Multi-channel SAADC front end as a sensor driver
+ *
+ * Every enabled devicetree node with compatible "generic,sensor-adc" is
+ * one instance, scanning the channels in its io-channels property in one
+ * SAADC scan (one frame). They must be listed in ascending channel order,
+ * since that is the order the scan stores them in:
+ *
+ *     sensor_adc: sensor-adc {
+ *         compatible = "generic,sensor-adc";
+ *         io-channels = <&adc 1>, <&adc 2>, <&adc 3>;
+ *     };
+ *
+ * The sensor API reads single frames: sensor_sample_fetch() takes a scan
+ * and keeps the raw codes, sensor_channel_get() converts them, all
+ * channels for SENSOR_CHAN_VOLTAGE or channel i for
+ * GENERIC_SENSOR_ADC_CHAN(i). Continuous acquisition streams raw frames
+ * into buffers owned by the caller, which converts them when it needs
+ * millivolts (see generic_sensor_adc_start()).
+ *
+ * Without such a node a single instance is taken from the io-channels of
+ * /zephyr,user, or the original three channels 1..3 on &adc. The channel
+ * count of the first instance is a plain integer literal, so the
+ * application can size buffers with it and unroll per-channel
+ * initializers and GATT attributes with UTIL_LISTIFY().
+ */
+#if DT_HAS_COMPAT_STATUS_OKAY(generic_sensor_adc)
+#define GENERIC_SENSOR_ADC_NODE         DT_INST(0, generic_sensor_adc)
+#else
+#define GENERIC_SENSOR_ADC_NODE         DT_PATH(zephyr_user)
+#endif
+
+#if DT_NODE_HAS_PROP(GENERIC_SENSOR_ADC_NODE, io_channels)
+#define GENERIC_SENSOR_ADC_CHANNELS                                     \
+    DT_PROP_LEN(GENERIC_SENSOR_ADC_NODE, io_channels)
+#define GENERIC_SENSOR_ADC_CHANNEL_ID(i)                                \
+    DT_IO_CHANNELS_INPUT_BY_IDX(GENERIC_SENSOR_ADC_NODE, i)
+#else
+#define GENERIC_SENSOR_ADC_CHANNELS     3
+#define GENERIC_SENSOR_ADC_CHANNEL_ID(i) ((i) + 1)
+#endif
 
+/* The instance the application samples */
+#if DT_HAS_COMPAT_STATUS_OKAY(generic_sensor_adc)
+#define GENERIC_SENSOR_ADC_DEVICE       DEVICE_DT_GET(GENERIC_SENSOR_ADC_NODE)
+#else
+DEVICE_DECLARE(generic_sensor_adc);
+#define GENERIC_SENSOR_ADC_DEVICE       DEVICE_GET(generic_sensor_adc)
 #endif
 
+/* Scan of one SAADC, whatever the instance */
+#define GENERIC_SENSOR_ADC_MAX_CHANNELS 8
+
+/* sensor_channel_get() channel of a single input, in volts */
+#define GENERIC_SENSOR_ADC_CHAN(i)      (SENSOR_CHAN_PRIV_START + (i))
+
+/*
+ * Frames collected in each half of the continuous-mode ping-pong buffer.
+ * A power of two keeps block averaging down to a shift.
+ */
+#define GENERIC_SENSOR_ADC_BLOCK_FRAMES 16
+
+/*
+ * Receives a finished block of interleaved raw frames in one of the
+ * caller's buffers, together with the uptime at which its last frame was
+ * converted. Runs on the sampling work queue. The block stays valid until
+ * the other buffer is full, i.e. for one block period.
+ */
+typedef void (*generic_sensor_adc_block_cb_t)(const struct device *dev,
+                                              const int16_t *block,
+                                              size_t frames,
+                                              uint32_t timestamp_us);
+
+uint8_t generic_sensor_adc_channels(const struct device *dev);
 
+/* One frame, or the mean of an oversampled burst, in mV */
+void generic_sensor_adc_sample(const struct device *dev, int16_t adc_voltage[]);
+void generic_sensor_adc_multi_sample(const struct device *dev,
+                                     int16_t adc_voltage[]);
+
+/* Raw codes of this instance to mV, in place if raw == adc_voltage */
+void generic_sensor_adc_convert(const struct device *dev, const int16_t raw[],
+                                int16_t adc_voltage[]);
+void generic_sensor_adc_convert_block(const struct device *dev,
+                                      const int16_t *raw, int16_t *adc_voltage,
+                                      size_t frames);
+void generic_sensor_adc_block_average(const struct device *dev,
+                                      const int16_t *block, size_t frames,
+                                      int16_t adc_voltage[]);
+
+/*
+ * Sample every interval_us into blocks, two buffers of frames interleaved
+ * frames each, filled in turn. Frames stay in raw codes. On the nRF SAADC
+ * the DMA writes every scan straight into its place in the block.
+ *
+ * With a channel divider above 1, only the channels due are converted,
+ * in one scan per deadline; the others repeat their last code.
+ */
+int generic_sensor_adc_start(const struct device *dev, uint32_t interval_us,
+                             int16_t *blocks, size_t frames,
+                             generic_sensor_adc_block_cb_t cb);
+void generic_sensor_adc_stop(const struct device *dev);
+
+/*
+ * Convert channel ch only every divider frames of continuous acquisition,
+ * every frame with 1. Starts out from the sample-dividers property. A
+ * running stream is restarted on the sampling work queue to apply it,
+ * losing the frames of the block being filled. Must be called from a
+ * thread.
+ */
+int generic_sensor_adc_set_divider(const struct device *dev, int ch,
+                                   uint16_t divider);
+uint16_t generic_sensor_adc_divider(const struct device *dev, int ch);
+
+/*
+ * Report channel ch only every divider frames of the application's
+ * stream, after decimation, every frame with 1. Starts out from the
+ * report-dividers property and applies to the next frame. The driver only
+ * keeps the setting, see CONFIG_GENERIC_SENSOR_REPORT_DIVIDERS.
+ */
+int generic_sensor_adc_set_report_divider(const struct device *dev, int ch,
+                                          uint16_t divider);
+uint16_t generic_sensor_adc_report_divider(const struct device *dev, int ch);
+
+/*
+ * Run the SAADC offset calibration. It runs on the sampling work queue,
+ * after any block already handed on, and the caller waits for it. A
+ * running stream is stopped for one calibrating scan and restarted on the
+ * same buffer half, losing the frames of the block being filled. Must be
+ * called from a thread.
+ */
+int generic_sensor_adc_calibrate(const struct device *dev);
+
+/*
+ * The sampling work queue, shared by all instances. Block callbacks, the
+ * multi-rate scheduler and calibration run on it one after the other.
+ */
+struct k_work_q *generic_sensor_adc_workq(void);
+
+/*
+ * Per-channel correction applied by every conversion: offset in raw codes
+ * subtracted first, then the gain in Q15 (32768 is 1.0) on the scale.
+ */
+void generic_sensor_adc_set_correction(const struct device *dev, int ch,
+                                       int16_t offset, uint16_t gain_q15);
+
+#ifdef CONFIG_GENERIC_SENSOR_ADC_SUPPLY
+/*
+ * Supply voltage in mV, VDD or VDDH. Every scan of the instance converts
+ * it after the sensor channels; this returns the mean of those since the
+ * last call, or takes a scan if there were none and nothing is streaming.
+ * -EAGAIN if a stream has not produced a scan since the last call.
+ */
+int generic_sensor_adc_supply(const struct device *dev, uint16_t *mv);
+#endif
+
+#endif
@@ -0,0 +1,197 @@
+/*
+ * Pack sensor frames into MTU-sized notifications
+ */
+
+#include "generic_sensor_batch.h"
+#include "generic_sensor_adc.h"
+#include "generic_sensor_metrics.h"
+
+#include <string.h>
+#include <sys/byteorder.h>
+#include <zephyr.h>
+#include <logging/log.h>
+
+LOG_MODULE_REGISTER(generic_sensor_batch, CONFIG_GENERIC_SENSOR_LOG_LEVEL);
+
+#define ATT_NOTIFY_OVERHEAD     3
+#define ATT_DEFAULT_MTU         23
+
+#define BATCH_FRAME_LEN         (GENERIC_SENSOR_ADC_CHANNELS * sizeof(int16_t))
+
+BUILD_ASSERT(GENERIC_SENSOR_BATCH_MAX_LEN >=
+             GENERIC_SENSOR_BATCH_HDR_LEN + BATCH_FRAME_LEN,
+             "L2CAP TX MTU too small for a single frame");
+
+static size_t batch_payload_len(const struct generic_sensor_batch *batch)
+{
+    return MIN(batch->mtu - ATT_NOTIFY_OVERHEAD,
+               GENERIC_SENSOR_BATCH_MAX_LEN) - GENERIC_SENSOR_BATCH_HDR_LEN;
+}
+
+/* Must be called with batch->lock held */
+static int batch_send(struct generic_sensor_batch *batch)
+{
+    int err;
+    size_t len;
+
+    if (!batch->count) {
+        return 0;
+    }
+
+    k_work_cancel_delayable(&batch->deadline_work);
+
+    batch->buf[0] = batch->count;
+    sys_put_le16(batch->first_seq, &batch->buf[1]);
+    sys_put_le32(batch->first_us, &batch->buf[3]);
+    len = generic_sensor_encoder_finish(&batch->enc);
+
+    err = batch->send(batch, batch->buf, GENERIC_SENSOR_BATCH_HDR_LEN + len);
+    if (err) {
+        LOG_WRN("Batch of %d frames dropped (err %d)", batch->count, err);
+    }
+
+    batch->count = 0;
+    return err;
+}
+
+/* Must be called with batch->lock held */
+static void batch_open(struct generic_sensor_batch *batch,
+                       const struct generic_sensor_frame *frame)
+{
+    batch->first_seq = frame->seq;
+    batch->first_us = frame->timestamp_us;
+    generic_sensor_encoder_init(&batch->enc, batch->encoding,
+                                GENERIC_SENSOR_ADC_CHANNELS,
+                                &batch->buf[GENERIC_SENSOR_BATCH_HDR_LEN],
+                                batch_payload_len(batch));
+    k_work_schedule(&batch->deadline_work, K_MSEC(batch->latency_ms));
+}
+
+static void deadline_work_handler(struct k_work *work)
+{
+    struct k_work_delayable *dwork = k_work_delayable_from_work(work);
+    struct generic_sensor_batch *batch =
+        CONTAINER_OF(dwork, struct generic_sensor_batch, deadline_work);
+
+    k_mutex_lock(&batch->lock, K_FOREVER);
+    batch_send(batch);
+    k_mutex_unlock(&batch->lock);
+}
+
+void generic_sensor_batch_init(struct generic_sensor_batch *batch,
+                               uint8_t encoding,
+                               generic_sensor_batch_send_t send,
+                               uint32_t latency_ms)
+{
+    batch->encoding = encoding;
+    batch->count = 0;
+    batch->mtu = ATT_DEFAULT_MTU;
+    batch->send = send;
+    batch->latency_ms = latency_ms;
+    k_mutex_init(&batch->lock);
+    k_work_init_delayable(&batch->deadline_work, deadline_work_handler);
+}
+
+void generic_sensor_batch_set_mtu(struct generic_sensor_batch *batch,
+                                  uint16_t mtu)
+{
+    mtu = MAX(mtu, ATT_DEFAULT_MTU);
+
+    k_mutex_lock(&batch->lock, K_FOREVER);
+    /* Frames already encoded were sized for the old MTU */
+    if (batch->count && mtu != batch->mtu) {
+        batch_send(batch);
+    }
+    batch->mtu = mtu;
+    k_mutex_unlock(&batch->lock);
+}
+
+void generic_sensor_batch_set_latency(struct generic_sensor_batch *batch,
+                                      uint32_t latency_ms)
+{
+    k_mutex_lock(&batch->lock, K_FOREVER);
+    batch->latency_ms = latency_ms;
+    k_mutex_unlock(&batch->lock);
+}
+
+void generic_sensor_batch_reset(struct generic_sensor_batch *batch)
+{
+    k_mutex_lock(&batch->lock, K_FOREVER);
+    k_work_cancel_delayable(&batch->deadline_work);
+    batch->count = 0;
+    k_mutex_unlock(&batch->lock);
+}
+
+/* With report dividers a frame carries only the channels due */
+static int batch_encode(struct generic_sensor_batch *batch,
+                        const struct generic_sensor_frame *frame)
+{
+    if (IS_ENABLED(CONFIG_GENERIC_SENSOR_REPORT_DIVIDERS)) {
+        return generic_sensor_encoder_add_masked(&batch->enc, frame->values,
+                                                 frame->report);
+    }
+
+    return generic_sensor_encoder_add(&batch->enc, frame->values);
+}
+
+size_t generic_sensor_batch_max_frame_len(uint8_t encoding)
+{
+    if (IS_ENABLED(CONFIG_GENERIC_SENSOR_REPORT_DIVIDERS)) {
+        return generic_sensor_encode_max_masked_frame_len(encoding,
+                        GENERIC_SENSOR_ADC_CHANNELS);
+    }
+
+    return generic_sensor_encode_max_frame_len(encoding,
+                                               GENERIC_SENSOR_ADC_CHANNELS);
+}
+
+int generic_sensor_batch_add(struct generic_sensor_batch *batch,
+                             const struct generic_sensor_frame *frame)
+{
+    uint32_t start;
+    int err = 0;
+
+    k_mutex_lock(&batch->lock, K_FOREVER);
+
+    /* A batch only describes consecutive frames, close it on a gap */
+    if (batch->count && frame->seq != batch->next_seq) {
+        err = batch_send(batch);
+    }
+
+    if (!batch->count) {
+        batch_open(batch, frame);
+    }
+
+    start = generic_sensor_metrics_start();
+    if (batch_encode(batch, frame)) {
+        /* Did not fit after all, ship what we have and start over */
+        err = batch_send(batch);
+        batch_open(batch, frame);
+        start = generic_sensor_metrics_start();
+        batch_encode(batch, frame);
+    }
+    generic_sensor_metrics_stage(GENERIC_SENSOR_STAGE_ENCODE, start);
+
+    batch->count++;
+    batch->next_seq = frame->seq + 1;
+
+    /* Send as soon as another worst-case frame might not fit */
+    if (batch->count == UINT8_MAX ||
+        batch->enc.size - batch->enc.len <
+        generic_sensor_batch_max_frame_len(batch->encoding)) {
+        err = batch_send(batch);
+    }
+
+    k_mutex_unlock(&batch->lock);
+    return err;
+}
+
+int generic_sensor_batch_flush(struct generic_sensor_batch *batch)
+{
+    int err;
+
+    k_mutex_lock(&batch->lock, K_FOREVER);
+    err = batch_send(batch);
+    k_mutex_unlock(&batch->lock);
+    return err;
+}
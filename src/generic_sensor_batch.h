@@ -0,0 +1,70 @@
+/*
+ * Pack sensor frames into MTU-sized notifications
+ */
+
+#include <stdint.h>
+#include <zephyr.h>
+
+#include "generic_sensor_encode.h"
+#include "generic_sensor_ring.h"
+
+#ifndef GENERIC_SENSOR_BATCH__H
+#define GENERIC_SENSOR_BATCH__H
+
+/*
+ * Batch layout (little endian):
+ *   uint8_t  count         frames in this batch
+ *   uint16_t first_seq     sequence number of the first frame
+ *   uint32_t timestamp_us  device time of the first frame
+ *   frame[count][GENERIC_SENSOR_ADC_CHANNELS] in the selected encoding,
+ *   see generic_sensor_encode.h, masked frames with
+ *   CONFIG_GENERIC_SENSOR_REPORT_DIVIDERS
+ *
+ * Frames follow each other at the filter's output interval.
+ */
+#define GENERIC_SENSOR_BATCH_HDR_LEN    7
+
+/* ATT notification overhead: opcode + attribute handle */
+#define GENERIC_SENSOR_BATCH_MAX_LEN    (CONFIG_BT_L2CAP_TX_MTU - 3)
+
+struct generic_sensor_batch;
+
+typedef int (*generic_sensor_batch_send_t)(struct generic_sensor_batch *batch,
+                                           const void *data, uint16_t len);
+
+/*
+ * One batch is encoded once and may be sent to several connections, so it
+ * is sized for the smallest MTU among them.
+ */
+struct generic_sensor_batch {
+    uint8_t buf[GENERIC_SENSOR_BATCH_MAX_LEN];
+    struct generic_sensor_encoder enc;
+    uint8_t encoding;
+    uint8_t count;
+    uint16_t first_seq;
+    uint32_t first_us;
+    uint16_t next_seq;
+    uint16_t mtu;
+    uint32_t latency_ms;
+    generic_sensor_batch_send_t send;
+    struct k_work_delayable deadline_work;
+    struct k_mutex lock;
+};
+
+void generic_sensor_batch_init(struct generic_sensor_batch *batch,
+                               uint8_t encoding,
+                               generic_sensor_batch_send_t send,
+                               uint32_t latency_ms);
+void generic_sensor_batch_set_mtu(struct generic_sensor_batch *batch,
+                                  uint16_t mtu);
+void generic_sensor_batch_set_latency(struct generic_sensor_batch *batch,
+                                      uint32_t latency_ms);
+void generic_sensor_batch_reset(struct generic_sensor_batch *batch);
+int generic_sensor_batch_add(struct generic_sensor_batch *batch,
+                             const struct generic_sensor_frame *frame);
+int generic_sensor_batch_flush(struct generic_sensor_batch *batch);
+
+/* The largest a frame can get in a batch of this encoding */
+size_t generic_sensor_batch_max_frame_len(uint8_t encoding);
+
+#endif
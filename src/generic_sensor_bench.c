@@ -0,0 +1,337 @@
+/*
+ * Off-target benchmark of the sampling and encoding pipeline
+ *
+ * With the ADC emulator each channel is fed a synthetic waveform, so the
+ * numbers do not depend on what is wired to the inputs. Processing cost is
+ * timed with the host clock on native_posix, where kernel time only moves
+ * while the CPU idles, and with the CPU cycle counter on hardware. Every
+ * figure with a CONFIG_GENERIC_SENSOR_BENCH_* limit is checked against it.
+ */
+
+#include "generic_sensor_bench.h"
+#include "generic_cycles.h"
+#include "generic_sensor_adc.h"
+#include "generic_sensor_encode.h"
+#include "generic_sensor_fft.h"
+#include "generic_sensor_filter.h"
+#include "generic_sensor_ring.h"
+
+#include <zephyr.h>
+#include <sys/printk.h>
+
+#ifdef CONFIG_ADC_EMUL
+#include <device.h>
+#include <drivers/adc/adc_emul.h>
+#endif
+
+#ifdef CONFIG_ARCH_POSIX
+#include <native_rtc.h>
+#include <posix_board_if.h>
+#endif
+
+#define BENCH_SINGLE_READS      256
+#define BENCH_BLOCKS            256
+#define BENCH_FFT_WINDOWS       16
+#define BENCH_SAMPLE_IVAL_US    1000
+/* ATT payload of a notification at the largest MTU in prj.conf */
+#define BENCH_NOTIFY_LEN        (CONFIG_BT_L2CAP_TX_MTU - 3)
+
+#define CHANNELS                GENERIC_SENSOR_ADC_CHANNELS
+#define BLOCK_FRAMES            GENERIC_SENSOR_ADC_BLOCK_FRAMES
+#define ADC_DEV                 GENERIC_SENSOR_ADC_DEVICE
+
+static int m_failures;
+
+static uint64_t bench_start(void)
+{
+#ifdef CONFIG_ARCH_POSIX
+    return native_rtc_gettime_us(RTC_CLOCK_PSEUDOHOSTREALTIME);
+#else
+    return generic_cycles_get();
+#endif
+}
+
+static uint32_t bench_elapsed_ns(uint64_t start)
+{
+#ifdef CONFIG_ARCH_POSIX
+    return (uint32_t)((native_rtc_gettime_us(RTC_CLOCK_PSEUDOHOSTREALTIME) -
+                       start) * 1000U);
+#else
+    return generic_cycles_to_ns(generic_cycles_get() - (uint32_t)start);
+#endif
+}
+
+/* One line per limit, so a failed run shows what regressed */
+static void bench_check(const char *what, uint32_t value, uint32_t limit,
+                        bool is_max)
+{
+    bool ok = is_max ? value <= limit : value >= limit;
+
+    printk("bench: check %s %u %s %u: %s\n", what, value,
+           is_max ? "<=" : ">=", limit, ok ? "ok" : "FAILED");
+    if (!ok) {
+        m_failures++;
+    }
+}
+
+/*
+ * Synthetic inputs in mV: channel i gets a triangle, square or sawtooth
+ * wave, in turn, with a period that grows with i.
+ */
+static uint32_t waveform_mv(unsigned int ch, uint32_t t_us)
+{
+    uint32_t period_us = 20000U * (ch + 1);
+    uint32_t phase = (t_us % period_us) * 3000U / period_us;
+
+    switch (ch % 3) {
+    case 0:
+        return phase < 1500 ? 2 * phase : 2 * (3000 - phase);
+    case 1:
+        return phase < 1500 ? 500 : 2500;
+    default:
+        return phase;
+    }
+}
+
+#ifdef CONFIG_ADC_EMUL
+static int emul_value(const struct device *dev, unsigned int chan,
+                      void *data, uint32_t *result)
+{
+    *result = waveform_mv(POINTER_TO_UINT(data),
+                          (uint32_t)k_ticks_to_us_floor64(k_uptime_ticks()));
+    return 0;
+}
+
+static void bench_feed_emulator(void)
+{
+    const struct device *dev = device_get_binding("ADC_0");
+
+    if (!dev) {
+        printk("bench: no ADC emulator\n");
+        return;
+    }
+
+#define BENCH_EMUL_CHANNEL(i, _)                                        \
+    adc_emul_value_func_set(dev, GENERIC_SENSOR_ADC_CHANNEL_ID(i),      \
+                            emul_value, UINT_TO_POINTER(i));
+    UTIL_LISTIFY(GENERIC_SENSOR_ADC_CHANNELS, BENCH_EMUL_CHANNEL, _)
+}
+#endif
+
+static void bench_single_reads(void)
+{
+    int16_t values[CHANNELS];
+    uint64_t start = bench_start();
+
+    for (int i = 0; i < BENCH_SINGLE_READS; i++) {
+        generic_sensor_adc_sample(ADC_DEV, values);
+    }
+
+    printk("bench: single read %u ns (%d reads)\n",
+           bench_elapsed_ns(start) / BENCH_SINGLE_READS, BENCH_SINGLE_READS);
+}
+
+static volatile uint32_t m_cont_frames;
+
+static void bench_block_ready(const struct device *dev, const int16_t *block,
+                              size_t frames, uint32_t timestamp_us)
+{
+    m_cont_frames += frames;
+}
+
+/* Rate the ADC sustains, in kernel time, with nothing else running */
+static void bench_continuous(void)
+{
+    static int16_t blocks[2 * BLOCK_FRAMES * CHANNELS];
+    const uint32_t requested = CHANNELS * (1000000U / BENCH_SAMPLE_IVAL_US);
+    uint32_t start_ms, elapsed_ms, rate;
+
+    m_cont_frames = 0;
+    start_ms = k_uptime_get_32();
+    if (generic_sensor_adc_start(ADC_DEV, BENCH_SAMPLE_IVAL_US, blocks,
+                                 BLOCK_FRAMES, bench_block_ready)) {
+        printk("bench: continuous sampling did not start\n");
+        m_failures++;
+        return;
+    }
+
+    k_sleep(K_SECONDS(CONFIG_GENERIC_SENSOR_BENCH_DURATION));
+    generic_sensor_adc_stop(ADC_DEV);
+    elapsed_ms = k_uptime_get_32() - start_ms;
+    rate = (uint32_t)((uint64_t)m_cont_frames * CHANNELS * 1000U /
+                      elapsed_ms);
+
+    printk("bench: continuous %u frames in %u ms, %u samples/s "
+           "(requested %u)\n", m_cont_frames, elapsed_ms, rate, requested);
+    bench_check("sample rate %", rate * 100U / requested,
+                CONFIG_GENERIC_SENSOR_BENCH_MIN_RATE, false);
+}
+
+/* Raw codes as the SAADC would return them for the synthetic inputs */
+static void bench_make_block(int16_t *block, uint32_t t_us)
+{
+    for (int i = 0; i < BLOCK_FRAMES; i++) {
+        for (int ch = 0; ch < CHANNELS; ch++) {
+            /* 3600 mV full scale over 14 bits */
+            block[i * CHANNELS + ch] = (int16_t)
+                (waveform_mv(ch, t_us) * ((1 << 14) - 1) / 3600);
+        }
+        t_us += BENCH_SAMPLE_IVAL_US;
+    }
+}
+
+/*
+ * Filter, convert, queue and encode BENCH_BLOCKS blocks the way the
+ * transmit path does, packing frames into notification sized buffers.
+ */
+static void bench_pipeline(uint8_t encoding)
+{
+    static int16_t block[BLOCK_FRAMES * CHANNELS];
+    static uint8_t notify_buf[BENCH_NOTIFY_LEN];
+    struct generic_sensor_encoder enc;
+    const struct generic_sensor_frame *frame;
+    uint16_t seq = 0;
+    uint32_t frames = 0, notifications = 0, bytes = 0;
+    uint32_t elapsed = 0;
+    size_t max_len = generic_sensor_encode_max_frame_len(encoding, CHANNELS);
+
+    generic_sensor_encoder_init(&enc, encoding, CHANNELS, notify_buf,
+                                sizeof(notify_buf));
+
+    for (int b = 0; b < BENCH_BLOCKS; b++) {
+        uint64_t start;
+
+        /* Only the pipeline is timed, not the waveform synthesis */
+        bench_make_block(block, b * BLOCK_FRAMES * BENCH_SAMPLE_IVAL_US);
+        start = bench_start();
+
+        /* The ring is drained after every block, it never fills up */
+        for (int i = 0; i < BLOCK_FRAMES; i++) {
+            struct generic_sensor_frame *slot = generic_sensor_ring_claim();
+
+            if (generic_sensor_filter_feed(&block[i * CHANNELS],
+                                           slot->values)) {
+                generic_sensor_adc_convert(ADC_DEV, slot->values,
+                                           slot->values);
+                slot->seq = seq++;
+                generic_sensor_ring_publish();
+            }
+        }
+
+        while ((frame = generic_sensor_ring_peek())) {
+            generic_sensor_encoder_add(&enc, frame->values);
+            generic_sensor_ring_release();
+            frames++;
+            if (enc.size - enc.len < max_len) {
+                bytes += generic_sensor_encoder_finish(&enc);
+                notifications++;
+                generic_sensor_encoder_init(&enc, encoding, CHANNELS,
+                                            notify_buf, sizeof(notify_buf));
+            }
+        }
+
+        elapsed += bench_elapsed_ns(start);
+    }
+
+    bytes += generic_sensor_encoder_finish(&enc);
+    notifications += enc.len ? 1 : 0;
+
+    if (!frames) {
+        printk("bench: encoding %u: no frames\n", encoding);
+        m_failures++;
+        return;
+    }
+
+    printk("bench: encoding %u: %u ns/frame, %u.%02u bytes/frame, "
+           "%u frames/notification, %u notifications\n", encoding,
+           elapsed / frames, bytes / frames, bytes * 100 / frames % 100,
+           frames / MAX(notifications, 1), notifications);
+    bench_check("ns/frame", elapsed / frames,
+                CONFIG_GENERIC_SENSOR_BENCH_MAX_FRAME_NS, true);
+}
+
+#ifdef CONFIG_GENERIC_SENSOR_FFT
+/* Transform cost of one window of every channel, on the synthetic inputs */
+static void bench_fft(void)
+{
+    static int16_t window[CHANNELS][CONFIG_GENERIC_SENSOR_FFT_SIZE];
+    static uint8_t summary[GENERIC_SENSOR_FFT_LEN];
+    const uint32_t window_us = CONFIG_GENERIC_SENSOR_FFT_SIZE *
+                               BENCH_SAMPLE_IVAL_US;
+    uint32_t elapsed = 0;
+    uint32_t per_window, share;
+
+    generic_sensor_fft_init(NULL);
+
+    for (int w = 0; w < BENCH_FFT_WINDOWS; w++) {
+        uint32_t t_us = w * window_us;
+        uint64_t start;
+
+        for (int n = 0; n < CONFIG_GENERIC_SENSOR_FFT_SIZE; n++) {
+            for (int ch = 0; ch < CHANNELS; ch++) {
+                window[ch][n] = waveform_mv(ch, t_us + n * BENCH_SAMPLE_IVAL_US);
+            }
+        }
+
+        start = bench_start();
+        generic_sensor_fft_compute(window, t_us,
+                                   t_us + window_us - BENCH_SAMPLE_IVAL_US,
+                                   summary);
+        elapsed += bench_elapsed_ns(start);
+    }
+
+    per_window = elapsed / BENCH_FFT_WINDOWS;
+    share = (uint32_t)((uint64_t)per_window * 100U / (window_us * 1000ULL));
+    printk("bench: fft %d points x %d channels: %u ns/window",
+           CONFIG_GENERIC_SENSOR_FFT_SIZE, CHANNELS, per_window);
+#ifndef CONFIG_ARCH_POSIX
+    printk(", %u cycles/window", (uint32_t)((uint64_t)per_window *
+           generic_cycles_per_sec() / 1000000000U));
+#endif
+    printk(", %u%% of the window at %u Hz\n", share,
+           1000000U / BENCH_SAMPLE_IVAL_US);
+    bench_check("fft window %", share,
+                CONFIG_GENERIC_SENSOR_BENCH_MAX_FFT_PERCENT, true);
+}
+#endif
+
+void generic_sensor_bench_run(void)
+{
+    const struct generic_sensor_filter_cfg stream = {
+        .type = GENERIC_SENSOR_FILTER_NONE,
+        .ratio = 1,
+    };
+    struct generic_sensor_filter_cfg saved;
+
+    printk("bench: %d channels, %d frames per block\n", CHANNELS,
+           BLOCK_FRAMES);
+
+#ifdef CONFIG_ADC_EMUL
+    bench_feed_emulator();
+#endif
+
+    bench_single_reads();
+    bench_continuous();
+
+    /* Stream every frame, so the encoders see the full rate */
+    generic_sensor_filter_get_config(&saved);
+    generic_sensor_filter_configure(&stream);
+    for (uint8_t e = 0; e < GENERIC_SENSOR_ENC_COUNT; e++) {
+        bench_pipeline(e);
+    }
+    generic_sensor_filter_configure(&saved);
+
+#ifdef CONFIG_GENERIC_SENSOR_FFT
+    bench_fft();
+#endif
+
+    if (m_failures) {
+        printk("bench: FAIL, %d checks failed\n", m_failures);
+    } else {
+        printk("bench: PASS\n");
+    }
+
+#ifdef CONFIG_ARCH_POSIX
+    posix_exit(m_failures ? 1 : 0);
+#endif
+}
@@ -0,0 +1,15 @@
+/*
+ * Off-target benchmark of the sampling and encoding pipeline
+ */
+
+#ifndef GENERIC_SENSOR_BENCH__H
+#define GENERIC_SENSOR_BENCH__H
+
+/*
+ * Runs the benchmark, prints its report ending in "bench: PASS" or
+ * "bench: FAIL" and, on native_posix, exits the process with status 1 if
+ * a check failed. Needs the ADC initialized and Bluetooth left disabled.
+ */
+void generic_sensor_bench_run(void);
+
+#endif
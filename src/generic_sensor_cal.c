@@ -0,0 +1,286 @@
+/*
+ * ADC calibration manager
+ *
+ * The periodic check runs on the ADC's sampling work queue rather than
+ * the system one: calibrating stops the stream for up to one sampling
+ * interval, which must neither stall other system work nor overlap the
+ * delivery of a block.
+ */
+
+#include "generic_sensor_cal.h"
+#include "generic_sensor_adc.h"
+
+#include <errno.h>
+#include <stdlib.h>
+#include <zephyr.h>
+#include <device.h>
+#include <drivers/sensor.h>
+#include <settings/settings.h>
+#include <logging/log.h>
+
+LOG_MODULE_REGISTER(generic_sensor_cal, CONFIG_GENERIC_SENSOR_ADC_LOG_LEVEL);
+
+#if defined(CONFIG_GENERIC_SENSOR_CAL_TEMP) && defined(CONFIG_TEMP_NRF5) && \
+    DT_HAS_COMPAT_STATUS_OKAY(nordic_nrf_temp)
+#define CAL_TEMP_DEV_NAME   DT_LABEL(DT_INST(0, nordic_nrf_temp))
+#endif
+
+#define CAL_INTERVAL_MS     (CONFIG_GENERIC_SENSOR_CAL_INTERVAL * 60 * 1000LL)
+
+static const struct device *m_adc;
+static struct generic_sensor_cal_coeff m_coeff[GENERIC_SENSOR_ADC_CHANNELS];
+static K_MUTEX_DEFINE(m_lock);
+static int64_t m_cal_ms;
+#ifdef CAL_TEMP_DEV_NAME
+static const struct device *m_temp_dev;
+static int32_t m_cal_temp;
+#endif
+
+static void check_work_handler(struct k_work *work);
+static K_WORK_DELAYABLE_DEFINE(m_check_work, check_work_handler);
+
+#ifdef CAL_TEMP_DEV_NAME
+static int read_temp(int32_t *celsius)
+{
+    struct sensor_value val;
+    int err;
+
+    err = sensor_sample_fetch(m_temp_dev);
+    if (!err) {
+        err = sensor_channel_get(m_temp_dev, SENSOR_CHAN_DIE_TEMP, &val);
+    }
+    if (!err) {
+        *celsius = val.val1;
+    }
+
+    return err;
+}
+#endif
+
+int generic_sensor_cal_run(void)
+{
+    int64_t now;
+    int err;
+#ifdef CAL_TEMP_DEV_NAME
+    int32_t temp;
+    bool have_temp;
+#endif
+
+    /* Serialised by the driver, m_lock is not held across the wait */
+    err = generic_sensor_adc_calibrate(m_adc);
+    if (err) {
+        LOG_WRN("Offset calibration failed (err %d)", err);
+        return err;
+    }
+
+    now = k_uptime_get();
+#ifdef CAL_TEMP_DEV_NAME
+    have_temp = m_temp_dev && !read_temp(&temp);
+#endif
+
+    k_mutex_lock(&m_lock, K_FOREVER);
+    m_cal_ms = now;
+#ifdef CAL_TEMP_DEV_NAME
+    if (have_temp) {
+        m_cal_temp = temp;
+    }
+#endif
+    k_mutex_unlock(&m_lock);
+
+#ifdef CAL_TEMP_DEV_NAME
+    if (have_temp) {
+        LOG_INF("Offset calibrated at %d C", temp);
+        return 0;
+    }
+#endif
+    LOG_INF("Offset calibrated");
+
+    return 0;
+}
+
+static void check_work_handler(struct k_work *work)
+{
+    bool due = CONFIG_GENERIC_SENSOR_CAL_INTERVAL &&
+               k_uptime_get() - m_cal_ms >= CAL_INTERVAL_MS;
+    k_timeout_t next = K_MINUTES(CONFIG_GENERIC_SENSOR_CAL_INTERVAL);
+
+#ifdef CAL_TEMP_DEV_NAME
+    int32_t temp;
+
+    if (m_temp_dev) {
+        if (!read_temp(&temp) &&
+            abs(temp - m_cal_temp) >= CONFIG_GENERIC_SENSOR_CAL_TEMP_DELTA) {
+            due = true;
+        }
+        next = K_SECONDS(CONFIG_GENERIC_SENSOR_CAL_TEMP_POLL);
+    }
+#endif
+
+    if (due) {
+        generic_sensor_cal_run();
+    }
+
+    k_work_reschedule_for_queue(generic_sensor_adc_workq(), &m_check_work,
+                                next);
+}
+
+void generic_sensor_cal_get(int ch, struct generic_sensor_cal_coeff *coeff)
+{
+    k_mutex_lock(&m_lock, K_FOREVER);
+    *coeff = m_coeff[ch];
+    k_mutex_unlock(&m_lock);
+}
+
+int generic_sensor_cal_set(int ch, const struct generic_sensor_cal_coeff *coeff)
+{
+    int err = 0;
+
+    if (ch < 0 || ch >= GENERIC_SENSOR_ADC_CHANNELS) {
+        return -EINVAL;
+    }
+
+    k_mutex_lock(&m_lock, K_FOREVER);
+    m_coeff[ch] = *coeff;
+    generic_sensor_adc_set_correction(m_adc, ch, coeff->offset,
+                                      coeff->gain_q15);
+#ifdef CONFIG_SETTINGS
+    err = settings_save_one("gs/cal/coeff", m_coeff, sizeof(m_coeff));
+#endif
+    k_mutex_unlock(&m_lock);
+
+    return err;
+}
+
+#ifdef CONFIG_SETTINGS
+static int cal_settings_set(const char *name, size_t len,
+                            settings_read_cb read_cb, void *cb_arg)
+{
+    const char *next;
+    ssize_t rc;
+
+    if (!settings_name_steq(name, "coeff", &next) || next) {
+        return -ENOENT;
+    }
+
+    /* Written for another channel table, start from nominal instead */
+    if (len != sizeof(m_coeff)) {
+        return -EINVAL;
+    }
+
+    rc = read_cb(cb_arg, m_coeff, sizeof(m_coeff));
+
+    return rc < 0 ? rc : 0;
+}
+
+SETTINGS_STATIC_HANDLER_DEFINE(gs_cal, "gs/cal", NULL, cal_settings_set,
+                               NULL, NULL);
+#endif
+
+int generic_sensor_cal_init(const struct device *adc)
+{
+    int err;
+
+    m_adc = adc;
+
+    for (int i = 0; i < GENERIC_SENSOR_ADC_CHANNELS; i++) {
+        m_coeff[i].offset = 0;
+        m_coeff[i].gain_q15 = GENERIC_SENSOR_CAL_GAIN_ONE;
+    }
+
+#ifdef CONFIG_SETTINGS
+    err = settings_subsys_init();
+    if (!err) {
+        err = settings_load_subtree("gs/cal");
+    }
+    if (err) {
+        LOG_WRN("Calibration not loaded (err %d)", err);
+    }
+#endif
+
+    for (int i = 0; i < GENERIC_SENSOR_ADC_CHANNELS; i++) {
+        generic_sensor_adc_set_correction(m_adc, i, m_coeff[i].offset,
+                                          m_coeff[i].gain_q15);
+    }
+
+#ifdef CAL_TEMP_DEV_NAME
+    m_temp_dev = device_get_binding(CAL_TEMP_DEV_NAME);
+    if (!m_temp_dev) {
+        LOG_WRN("No die temperature sensor, schedule only");
+    }
+#endif
+
+    err = generic_sensor_cal_run();
+
+    /* Nothing to check for without a schedule or a temperature sensor */
+#ifdef CAL_TEMP_DEV_NAME
+    if (m_temp_dev) {
+        k_work_schedule_for_queue(
+            generic_sensor_adc_workq(), &m_check_work,
+            K_SECONDS(CONFIG_GENERIC_SENSOR_CAL_TEMP_POLL));
+        return err;
+    }
+#endif
+    if (CONFIG_GENERIC_SENSOR_CAL_INTERVAL) {
+        k_work_schedule_for_queue(
+            generic_sensor_adc_workq(), &m_check_work,
+            K_MINUTES(CONFIG_GENERIC_SENSOR_CAL_INTERVAL));
+    }
+
+    return err;
+}
+
+#ifdef CONFIG_GENERIC_SENSOR_CAL_SHELL
+#include <shell/shell.h>
+
+static int cmd_cal_show(const struct shell *shell, size_t argc, char **argv)
+{
+    struct generic_sensor_cal_coeff coeff;
+
+    for (int i = 0; i < GENERIC_SENSOR_ADC_CHANNELS; i++) {
+        generic_sensor_cal_get(i, &coeff);
+        shell_print(shell, "ch%d offset %d gain %u/%u", i, coeff.offset,
+                    coeff.gain_q15, GENERIC_SENSOR_CAL_GAIN_ONE);
+    }
+    shell_print(shell, "offset calibrated %lld s ago",
+                (k_uptime_get() - m_cal_ms) / 1000);
+
+    return 0;
+}
+
+static int cmd_cal_set(const struct shell *shell, size_t argc, char **argv)
+{
+    struct generic_sensor_cal_coeff coeff;
+    int ch = strtol(argv[1], NULL, 0);
+    long gain = strtol(argv[3], NULL, 0);
+    int err;
+
+    coeff.offset = strtol(argv[2], NULL, 0);
+    if (gain <= 0 || gain > UINT16_MAX) {
+        shell_error(shell, "gain must be 1..%u", UINT16_MAX);
+        return -EINVAL;
+    }
+    coeff.gain_q15 = gain;
+
+    err = generic_sensor_cal_set(ch, &coeff);
+    if (err) {
+        shell_error(shell, "failed (err %d)", err);
+    }
+
+    return err;
+}
+
+static int cmd_cal_run(const struct shell *shell, size_t argc, char **argv)
+{
+    return generic_sensor_cal_run();
+}
+
+SHELL_STATIC_SUBCMD_SET_CREATE(sub_cal,
+    SHELL_CMD(show, NULL, "Print coefficients", cmd_cal_show),
+    SHELL_CMD_ARG(set, NULL, "<ch> <offset> <gain_q15>  Store factory "
+                  "coefficients", cmd_cal_set, 4, 0),
+    SHELL_CMD(run, NULL, "Run the offset calibration now", cmd_cal_run),
+    SHELL_SUBCMD_SET_END
+);
+
+SHELL_CMD_REGISTER(cal, &sub_cal, "ADC calibration", NULL);
+#endif
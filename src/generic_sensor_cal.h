@@ -0,0 +1,38 @@
+/*
+ * ADC calibration manager
+ *
+ * The SAADC offset calibration runs once at boot and then only when
+ * CONFIG_GENERIC_SENSOR_CAL_INTERVAL has passed or the die temperature has
+ * moved by CONFIG_GENERIC_SENSOR_CAL_TEMP_DELTA since the last run. On top
+ * of it every channel has a factory gain/offset correction, kept in the
+ * settings subsystem under "gs/cal".
+ */
+
+#include <stdint.h>
+#include <device.h>
+
+#ifndef GENERIC_SENSOR_CAL__H
+#define GENERIC_SENSOR_CAL__H
+
+#define GENERIC_SENSOR_CAL_GAIN_ONE     32768
+
+struct generic_sensor_cal_coeff {
+    int16_t offset;     /* raw codes read with the input at 0 V */
+    uint16_t gain_q15;  /* GENERIC_SENSOR_CAL_GAIN_ONE is 1.0 */
+};
+
+/*
+ * Load and apply the coefficients to the channels of the sensor ADC
+ * instance adc, calibrate it, start the checks
+ */
+int generic_sensor_cal_init(const struct device *adc);
+
+/* Offset calibration now, e.g. from the shell */
+int generic_sensor_cal_run(void);
+
+void generic_sensor_cal_get(int ch, struct generic_sensor_cal_coeff *coeff);
+
+/* Apply and, with CONFIG_SETTINGS, persist the coefficients of ch */
+int generic_sensor_cal_set(int ch, const struct generic_sensor_cal_coeff *coeff);
+
+#endif
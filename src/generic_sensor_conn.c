@@ -0,0 +1,136 @@
+/*
+ * Per-connection sensor stream state
+ *
+ * Entries are indexed by bt_conn_index(), so every callback that gets a
+ * bt_conn finds its state without searching.
+ */
+
+#include "generic_sensor_conn.h"
+#include "generic_sensor_encode.h"
+#include "generic_sensor_metrics.h"
+
+#include <errno.h>
+#include <zephyr.h>
+
+#define ATT_DEFAULT_MTU     23
+
+static struct generic_sensor_conn m_conns[CONFIG_BT_MAX_CONN];
+
+struct generic_sensor_conn *generic_sensor_conn_add(struct bt_conn *conn,
+        const struct generic_sensor_triggers *triggers)
+{
+    struct generic_sensor_conn *gc = &m_conns[bt_conn_index(conn)];
+
+    gc->conn = bt_conn_ref(conn);
+    gc->subscribed = false;
+    gc->mtu = bt_gatt_get_mtu(conn);
+    gc->encoding = GENERIC_SENSOR_ENC_RAW16;
+    gc->triggers = *triggers;
+    gc->tx_dropped = 0;
+    gc->tx_ready = NULL;
+    atomic_set(&gc->tx_credits, CONFIG_GENERIC_SENSOR_TX_CREDITS);
+
+    return gc;
+}
+
+void generic_sensor_conn_remove(struct bt_conn *conn)
+{
+    struct generic_sensor_conn *gc = &m_conns[bt_conn_index(conn)];
+
+    if (gc->conn) {
+        bt_conn_unref(gc->conn);
+        gc->conn = NULL;
+        gc->subscribed = false;
+        gc->tx_ready = NULL;
+    }
+}
+
+struct generic_sensor_conn *generic_sensor_conn_get(struct bt_conn *conn)
+{
+    struct generic_sensor_conn *gc;
+
+    if (!conn) {
+        return NULL;
+    }
+
+    gc = &m_conns[bt_conn_index(conn)];
+    return gc->conn ? gc : NULL;
+}
+
+void generic_sensor_conn_foreach(generic_sensor_conn_func_t func,
+                                 void *user_data)
+{
+    for (int i = 0; i < ARRAY_SIZE(m_conns); i++) {
+        if (m_conns[i].conn) {
+            func(&m_conns[i], user_data);
+        }
+    }
+}
+
+static void notify_sent(struct bt_conn *conn, void *user_data)
+{
+    struct generic_sensor_conn *gc = generic_sensor_conn_get(conn);
+    generic_sensor_conn_cb_t tx_ready;
+    atomic_val_t credits;
+
+    /* Sent before a disconnect: the slot is free or serves someone else */
+    if (gc != user_data || gc->conn != conn) {
+        return;
+    }
+
+    /*
+     * A reconnect can reuse the same bt_conn while completions of the
+     * old link are still due, so never go beyond a full set of credits
+     */
+    do {
+        credits = atomic_get(&gc->tx_credits);
+        if (credits >= CONFIG_GENERIC_SENSOR_TX_CREDITS) {
+            return;
+        }
+    } while (!atomic_cas(&gc->tx_credits, credits, credits + 1));
+
+    tx_ready = gc->tx_ready;
+    if (tx_ready) {
+        tx_ready(gc);
+    }
+}
+
+int generic_sensor_conn_notify(struct generic_sensor_conn *gc,
+                               const struct bt_gatt_attr *attr,
+                               const void *data, uint16_t len)
+{
+    struct bt_gatt_notify_params params = {
+        .attr = attr,
+        .data = data,
+        .len = len,
+        .func = notify_sent,
+        .user_data = gc,
+    };
+    uint32_t start;
+    int err;
+
+    /* atomic_dec() returns the value before the decrement */
+    if (atomic_dec(&gc->tx_credits) <= 0) {
+        atomic_inc(&gc->tx_credits);
+        gc->tx_dropped++;
+        generic_sensor_metrics_count(GENERIC_SENSOR_CNT_NOTIFY_BUSY, 1);
+        return -EBUSY;
+    }
+
+    start = generic_sensor_metrics_start();
+    err = bt_gatt_notify_cb(gc->conn, &params);
+    generic_sensor_metrics_stage(GENERIC_SENSOR_STAGE_NOTIFY, start);
+    if (err) {
+        atomic_inc(&gc->tx_credits);
+        generic_sensor_metrics_count(GENERIC_SENSOR_CNT_NOTIFY_ERRORS, 1);
+        if (err == -ENOMEM) {
+            generic_sensor_metrics_count(GENERIC_SENSOR_CNT_NOTIFY_ENOMEM, 1);
+        }
+    } else {
+        /* ATT copies the payload into a buffer of its own */
+        generic_sensor_metrics_count(GENERIC_SENSOR_CNT_ALLOCS, 1);
+        generic_sensor_metrics_count(GENERIC_SENSOR_CNT_COPIES, 1);
+    }
+
+    return err;
+}
@@ -0,0 +1,53 @@
+/*
+ * Per-connection sensor stream state
+ */
+
+#include <stdbool.h>
+#include <stdint.h>
+#include <zephyr.h>
+#include <bluetooth/conn.h>
+#include <bluetooth/gatt.h>
+
+#include "generic_sensor_trigger.h"
+
+#ifndef GENERIC_SENSOR_CONN__H
+#define GENERIC_SENSOR_CONN__H
+
+struct generic_sensor_conn;
+
+typedef void (*generic_sensor_conn_cb_t)(struct generic_sensor_conn *gc);
+
+struct generic_sensor_conn {
+    struct bt_conn *conn;
+    bool subscribed;
+    uint16_t mtu;
+    uint8_t encoding;
+    struct generic_sensor_triggers triggers;
+
+    /* Notifications this connection may still queue in the stack */
+    atomic_t tx_credits;
+    uint32_t tx_dropped;
+    /* Called from the stack whenever a credit returns, if set */
+    generic_sensor_conn_cb_t tx_ready;
+};
+
+typedef void (*generic_sensor_conn_func_t)(struct generic_sensor_conn *gc,
+                                           void *user_data);
+
+/* Claim the slot for a new connection, starting from the given triggers */
+struct generic_sensor_conn *generic_sensor_conn_add(struct bt_conn *conn,
+        const struct generic_sensor_triggers *triggers);
+void generic_sensor_conn_remove(struct bt_conn *conn);
+struct generic_sensor_conn *generic_sensor_conn_get(struct bt_conn *conn);
+void generic_sensor_conn_foreach(generic_sensor_conn_func_t func,
+                                 void *user_data);
+
+/*
+ * Notify one connection if it has a TX credit left. A connection that
+ * cannot keep up loses frames with -EBUSY instead of stalling the others.
+ */
+int generic_sensor_conn_notify(struct generic_sensor_conn *gc,
+                               const struct bt_gatt_attr *attr,
+                               const void *data, uint16_t len);
+
+#endif
@@ -0,0 +1,407 @@
+/*
+ * Wire encodings for the sensor sample stream
+ */
+
+#include "generic_sensor_encode.h"
+
+#include <errno.h>
+#include <stdbool.h>
+#include <string.h>
+
+#define PACKED14_BITS   14
+#define PACKED14_MIN    (-(1 << (PACKED14_BITS - 1)))
+#define PACKED14_MAX    ((1 << (PACKED14_BITS - 1)) - 1)
+#define PACKED14_MASK   ((1U << PACKED14_BITS) - 1)
+
+/* A zigzagged 17-bit difference needs at most three 7-bit groups */
+#define VARINT_MAX_LEN  3
+
+static inline uint32_t zigzag_encode(int32_t v)
+{
+    return ((uint32_t)v << 1) ^ (uint32_t)(v >> 31);
+}
+
+static inline int32_t zigzag_decode(uint32_t v)
+{
+    return (int32_t)(v >> 1) ^ -(int32_t)(v & 1);
+}
+
+static int put_u8(struct generic_sensor_encoder *enc, uint8_t b)
+{
+    if (enc->len >= enc->size) {
+        return -ENOMEM;
+    }
+
+    enc->buf[enc->len++] = b;
+    return 0;
+}
+
+static int put_le16(struct generic_sensor_encoder *enc, int16_t v)
+{
+    if (put_u8(enc, (uint16_t)v & 0xff)) {
+        return -ENOMEM;
+    }
+
+    return put_u8(enc, (uint16_t)v >> 8);
+}
+
+static int put_varint(struct generic_sensor_encoder *enc, uint32_t v)
+{
+    while (v >= 0x80) {
+        if (put_u8(enc, (v & 0x7f) | 0x80)) {
+            return -ENOMEM;
+        }
+        v >>= 7;
+    }
+
+    return put_u8(enc, v);
+}
+
+/* Append the low nbits of v to the PACKED14 bit stream */
+static int put_bits(struct generic_sensor_encoder *enc, uint32_t v,
+                    uint8_t nbits)
+{
+    enc->bits |= (v & ((1U << nbits) - 1)) << enc->nbits;
+    enc->nbits += nbits;
+
+    while (enc->nbits >= 8) {
+        if (put_u8(enc, enc->bits & 0xff)) {
+            return -ENOMEM;
+        }
+        enc->bits >>= 8;
+        enc->nbits -= 8;
+    }
+
+    /* Keep room for the partial byte that finish() will write */
+    if (enc->nbits && enc->len >= enc->size) {
+        return -ENOMEM;
+    }
+
+    return 0;
+}
+
+static int put_packed14(struct generic_sensor_encoder *enc, int16_t v)
+{
+    int32_t clamped = v < PACKED14_MIN ? PACKED14_MIN :
+                      v > PACKED14_MAX ? PACKED14_MAX : v;
+
+    return put_bits(enc, (uint32_t)clamped, PACKED14_BITS);
+}
+
+/* One sample of channel ch, a keyframe on the channel's first */
+static int put_sample(struct generic_sensor_encoder *enc, int ch, int16_t v)
+{
+    int err;
+
+    switch (enc->format) {
+    case GENERIC_SENSOR_ENC_PACKED14:
+        return put_packed14(enc, v);
+    case GENERIC_SENSOR_ENC_DELTA:
+        if (!(enc->keyed & (1U << ch))) {
+            err = put_le16(enc, v);
+        } else {
+            err = put_varint(enc, zigzag_encode((int32_t)v - enc->prev[ch]));
+        }
+        enc->keyed |= 1U << ch;
+        enc->prev[ch] = v;
+        return err;
+    default:
+        return put_le16(enc, v);
+    }
+}
+
+int generic_sensor_encoding_is_valid(uint8_t format)
+{
+    return format == GENERIC_SENSOR_ENC_RAW16 ||
+           format == GENERIC_SENSOR_ENC_PACKED14 ||
+           format == GENERIC_SENSOR_ENC_DELTA;
+}
+
+size_t generic_sensor_encode_max_frame_len(uint8_t format, uint8_t channels)
+{
+    switch (format) {
+    case GENERIC_SENSOR_ENC_PACKED14:
+        /* Up to one byte can be left over from the previous frame */
+        return (channels * PACKED14_BITS + 7) / 8 + 1;
+    case GENERIC_SENSOR_ENC_DELTA:
+        return channels * VARINT_MAX_LEN;
+    default:
+        return channels * sizeof(int16_t);
+    }
+}
+
+size_t generic_sensor_encode_max_masked_frame_len(uint8_t format,
+                                                  uint8_t channels)
+{
+    return generic_sensor_encode_max_frame_len(format, channels) + 1;
+}
+
+void generic_sensor_encoder_init(struct generic_sensor_encoder *enc,
+                                 uint8_t format, uint8_t channels,
+                                 uint8_t *buf, size_t size)
+{
+    memset(enc, 0, sizeof(*enc));
+    enc->format = format;
+    enc->channels = channels;
+    enc->buf = buf;
+    enc->size = size;
+}
+
+int generic_sensor_encoder_add(struct generic_sensor_encoder *enc,
+                               const int16_t frame[])
+{
+    struct generic_sensor_encoder saved = *enc;
+    int err = 0;
+
+    for (int i = 0; i < enc->channels && !err; i++) {
+        err = put_sample(enc, i, frame[i]);
+    }
+
+    if (err) {
+        *enc = saved;
+        return err;
+    }
+
+    enc->frames++;
+    return 0;
+}
+
+int generic_sensor_encoder_add_masked(struct generic_sensor_encoder *enc,
+                                      const int16_t frame[], uint8_t mask)
+{
+    struct generic_sensor_encoder saved = *enc;
+    int err;
+
+    if (enc->channels < 8 && mask >> enc->channels) {
+        return -EINVAL;
+    }
+
+    if (enc->format == GENERIC_SENSOR_ENC_PACKED14) {
+        err = put_bits(enc, mask, 8);
+    } else {
+        err = put_u8(enc, mask);
+    }
+
+    for (int i = 0; i < enc->channels && !err; i++) {
+        if (mask & (1U << i)) {
+            err = put_sample(enc, i, frame[i]);
+        }
+    }
+
+    if (err) {
+        *enc = saved;
+        return err;
+    }
+
+    enc->frames++;
+    return 0;
+}
+
+size_t generic_sensor_encoder_finish(struct generic_sensor_encoder *enc)
+{
+    /* put_packed14() reserved room for this byte */
+    if (enc->nbits) {
+        enc->buf[enc->len++] = enc->bits & 0xff;
+        enc->bits = 0;
+        enc->nbits = 0;
+    }
+
+    return enc->len;
+}
+
+static int get_varint(const uint8_t *src, size_t len, size_t *pos,
+                      uint32_t *v)
+{
+    *v = 0;
+
+    for (int shift = 0; shift < 7 * VARINT_MAX_LEN; shift += 7) {
+        if (*pos >= len) {
+            return -EINVAL;
+        }
+
+        uint8_t b = src[(*pos)++];
+
+        *v |= (uint32_t)(b & 0x7f) << shift;
+        if (!(b & 0x80)) {
+            return 0;
+        }
+    }
+
+    return -EINVAL;
+}
+
+int generic_sensor_decode(uint8_t format, uint8_t channels,
+                          const uint8_t *src, size_t len,
+                          int16_t *samples, uint16_t frames)
+{
+    size_t count = (size_t)frames * channels;
+    size_t pos = 0;
+
+    if (channels > GENERIC_SENSOR_ENC_MAX_CHANNELS) {
+        return -EINVAL;
+    }
+
+    switch (format) {
+    case GENERIC_SENSOR_ENC_RAW16:
+        if (len < count * sizeof(int16_t)) {
+            return -EINVAL;
+        }
+        for (size_t i = 0; i < count; i++, pos += 2) {
+            samples[i] = (int16_t)(src[pos] | (src[pos + 1] << 8));
+        }
+        return pos;
+
+    case GENERIC_SENSOR_ENC_PACKED14: {
+        uint32_t bits = 0;
+        uint8_t nbits = 0;
+
+        for (size_t i = 0; i < count; i++) {
+            while (nbits < PACKED14_BITS) {
+                if (pos >= len) {
+                    return -EINVAL;
+                }
+                bits |= (uint32_t)src[pos++] << nbits;
+                nbits += 8;
+            }
+
+            uint32_t v = bits & PACKED14_MASK;
+
+            /* Sign extend from 14 bits */
+            samples[i] = (int16_t)((int32_t)(v << (32 - PACKED14_BITS)) >>
+                                   (32 - PACKED14_BITS));
+            bits >>= PACKED14_BITS;
+            nbits -= PACKED14_BITS;
+        }
+        return pos;
+    }
+
+    case GENERIC_SENSOR_ENC_DELTA:
+        for (size_t i = 0; i < count; i++) {
+            if (i < channels) {
+                if (pos + 2 > len) {
+                    return -EINVAL;
+                }
+                samples[i] = (int16_t)(src[pos] | (src[pos + 1] << 8));
+                pos += 2;
+            } else {
+                uint32_t zz;
+
+                if (get_varint(src, len, &pos, &zz)) {
+                    return -EINVAL;
+                }
+                samples[i] = (int16_t)(samples[i - channels] +
+                                       zigzag_decode(zz));
+            }
+        }
+        return pos;
+
+    default:
+        return -EINVAL;
+    }
+}
+
+/* Bit reader over the PACKED14 stream */
+struct bit_reader {
+    const uint8_t *src;
+    size_t len;
+    size_t pos;
+    uint32_t bits;
+    uint8_t nbits;
+};
+
+static int get_bits(struct bit_reader *r, uint8_t nbits, uint32_t *v)
+{
+    while (r->nbits < nbits) {
+        if (r->pos >= r->len) {
+            return -EINVAL;
+        }
+        r->bits |= (uint32_t)r->src[r->pos++] << r->nbits;
+        r->nbits += 8;
+    }
+
+    *v = r->bits & ((1U << nbits) - 1);
+    r->bits >>= nbits;
+    r->nbits -= nbits;
+
+    return 0;
+}
+
+static int get_sample(uint8_t format, struct bit_reader *r, bool key,
+                      int16_t prev, int16_t *sample)
+{
+    uint32_t v;
+
+    if (format == GENERIC_SENSOR_ENC_PACKED14) {
+        if (get_bits(r, PACKED14_BITS, &v)) {
+            return -EINVAL;
+        }
+        *sample = (int16_t)((int32_t)(v << (32 - PACKED14_BITS)) >>
+                            (32 - PACKED14_BITS));
+        return 0;
+    }
+
+    if (format == GENERIC_SENSOR_ENC_DELTA && !key) {
+        if (get_varint(r->src, r->len, &r->pos, &v)) {
+            return -EINVAL;
+        }
+        *sample = (int16_t)(prev + zigzag_decode(v));
+        return 0;
+    }
+
+    if (r->pos + 2 > r->len) {
+        return -EINVAL;
+    }
+    *sample = (int16_t)(r->src[r->pos] | (r->src[r->pos + 1] << 8));
+    r->pos += 2;
+
+    return 0;
+}
+
+int generic_sensor_decode_masked(uint8_t format, uint8_t channels,
+                                 const uint8_t *src, size_t len,
+                                 int16_t *samples, uint8_t *masks,
+                                 uint16_t frames)
+{
+    struct bit_reader r = { .src = src, .len = len };
+    int16_t prev[GENERIC_SENSOR_ENC_MAX_CHANNELS] = { 0 };
+    uint8_t keyed = 0;
+
+    if (channels > GENERIC_SENSOR_ENC_MAX_CHANNELS ||
+        !generic_sensor_encoding_is_valid(format)) {
+        return -EINVAL;
+    }
+
+    for (uint16_t f = 0; f < frames; f++) {
+        int16_t *frame = &samples[(size_t)f * channels];
+        uint32_t mask;
+
+        if (format == GENERIC_SENSOR_ENC_PACKED14) {
+            if (get_bits(&r, 8, &mask)) {
+                return -EINVAL;
+            }
+        } else if (r.pos < len) {
+            mask = src[r.pos++];
+        } else {
+            return -EINVAL;
+        }
+
+        if (channels < 8 && mask >> channels) {
+            return -EINVAL;
+        }
+        masks[f] = mask;
+
+        for (int i = 0; i < channels; i++) {
+            if (!(mask & (1U << i))) {
+                continue;
+            }
+            if (get_sample(format, &r, !(keyed & (1U << i)), prev[i],
+                           &frame[i])) {
+                return -EINVAL;
+            }
+            keyed |= 1U << i;
+            prev[i] = frame[i];
+        }
+    }
+
+    return r.pos;
+}
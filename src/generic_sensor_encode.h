@@ -0,0 +1,104 @@
+/*
+ * Wire encodings for the sensor sample stream
+ *
+ * This file and generic_sensor_encode.c only depend on the C library, so
+ * host tools can build them unchanged to decode captured notifications.
+ */
+
+#include <stddef.h>
+#include <stdint.h>
+
+#ifndef GENERIC_SENSOR_ENCODE__H
+#define GENERIC_SENSOR_ENCODE__H
+
+/*
+ * GENERIC_SENSOR_ENC_RAW16
+ *   int16_t little endian per sample.
+ * GENERIC_SENSOR_ENC_PACKED14
+ *   14-bit two's complement per sample, packed LSB first into a
+ *   continuous bit stream and padded to a whole byte at the end. Values
+ *   outside -8192..8191 are clamped.
+ * GENERIC_SENSOR_ENC_DELTA
+ *   The first frame is a keyframe in RAW16. Every following sample is
+ *   the difference to the previous sample of the same channel, zigzag
+ *   mapped and written as an unsigned LEB128 varint (1..3 bytes).
+ *
+ * Samples are always interleaved frame by frame. The frame count is not
+ * part of the encoding, it travels in the surrounding header.
+ *
+ * Masked frames start with a channel mask (bit i for channel i) and hold
+ * only the samples of the channels set in it, in the same format: the
+ * mask is a byte, or 8 bits of the stream for PACKED14. In DELTA the first
+ * sample of each channel is its keyframe, later ones refer to the last
+ * sample of that channel, however many frames ago.
+ */
+enum generic_sensor_encoding {
+    GENERIC_SENSOR_ENC_RAW16 = 0x00,
+    GENERIC_SENSOR_ENC_PACKED14 = 0x01,
+    GENERIC_SENSOR_ENC_DELTA = 0x02,
+
+    GENERIC_SENSOR_ENC_COUNT
+};
+
+#define GENERIC_SENSOR_ENC_MAX_CHANNELS 8
+
+struct generic_sensor_encoder {
+    uint8_t format;
+    uint8_t channels;
+    uint16_t frames;
+    uint8_t *buf;
+    size_t size;
+    size_t len;
+    uint32_t bits;
+    uint8_t nbits;
+    /* Channels whose DELTA keyframe has been written */
+    uint8_t keyed;
+    int16_t prev[GENERIC_SENSOR_ENC_MAX_CHANNELS];
+};
+
+int generic_sensor_encoding_is_valid(uint8_t format);
+
+/* Worst-case encoded size of one frame */
+size_t generic_sensor_encode_max_frame_len(uint8_t format, uint8_t channels);
+size_t generic_sensor_encode_max_masked_frame_len(uint8_t format,
+                                                  uint8_t channels);
+
+void generic_sensor_encoder_init(struct generic_sensor_encoder *enc,
+                                 uint8_t format, uint8_t channels,
+                                 uint8_t *buf, size_t size);
+
+/*
+ * Append one frame. Returns -ENOMEM and leaves the encoder untouched if
+ * the frame does not fit.
+ */
+int generic_sensor_encoder_add(struct generic_sensor_encoder *enc,
+                               const int16_t frame[]);
+
+/*
+ * Append one masked frame, with the samples of the channels in mask only.
+ * Returns -EINVAL for a channel beyond the encoder's, -ENOMEM as above.
+ */
+int generic_sensor_encoder_add_masked(struct generic_sensor_encoder *enc,
+                                      const int16_t frame[], uint8_t mask);
+
+/* Flush pending bits and return the encoded length */
+size_t generic_sensor_encoder_finish(struct generic_sensor_encoder *enc);
+
+/*
+ * Reference decoder: decode `frames` frames from src into samples.
+ * Returns the number of bytes consumed or -EINVAL on malformed input.
+ */
+int generic_sensor_decode(uint8_t format, uint8_t channels,
+                          const uint8_t *src, size_t len,
+                          int16_t *samples, uint16_t frames);
+
+/*
+ * The same for masked frames. The mask of each frame goes to masks[],
+ * samples of channels not in it are left as they were.
+ */
+int generic_sensor_decode_masked(uint8_t format, uint8_t channels,
+                                 const uint8_t *src, size_t len,
+                                 int16_t *samples, uint8_t *masks,
+                                 uint16_t frames);
+
+#endif
@@ -0,0 +1,464 @@
+/*
+ * Spectral features of the frame stream
+ *
+ * Radix-2 complex FFT in q15 with a halving at every stage, so it cannot
+ * overflow. Two real channels go through one complex transform, one as the
+ * real and one as the imaginary part, and are separated again using the
+ * symmetry of real spectra. Every channel is scaled to 14 bits before the
+ * transform (block floating point), so quiet signals keep their
+ * resolution. All arithmetic is integer, the twiddles included.
+ */
+
+#include "generic_sensor_fft.h"
+
+#include <errno.h>
+#include <stdlib.h>
+#include <string.h>
+#include <zephyr.h>
+#include <sys/byteorder.h>
+
+#define N                       CONFIG_GENERIC_SENSOR_FFT_SIZE
+#define HALF                    (N / 2)
+#define BANDS                   CONFIG_GENERIC_SENSOR_FFT_BANDS
+#define CHANNELS                GENERIC_SENSOR_ADC_CHANNELS
+
+#define NO_BAND                 0xff
+
+/* 2 pi in Q30 */
+#define TWO_PI_Q30              6746518852LL
+
+/* Below the transmit thread, which must never wait for a transform */
+#define FFT_THREAD_STACK_SIZE   1536
+#define FFT_THREAD_PRIORITY     K_PRIO_PREEMPT(7)
+
+BUILD_ASSERT(N >= 16 && (N & (N - 1)) == 0,
+             "CONFIG_GENERIC_SENSOR_FFT_SIZE must be a power of two");
+BUILD_ASSERT(BANDS <= HALF && BANDS < NO_BAND, "Too many bands for the FFT");
+BUILD_ASSERT(GENERIC_SENSOR_FFT_LEN <= CONFIG_BT_L2CAP_TX_MTU - 3,
+             "Spectrum summary does not fit a notification, use fewer bands");
+
+struct cpx {
+    int16_t re;
+    int16_t im;
+};
+
+struct channel_spectrum {
+    uint64_t energy[BANDS];
+    uint64_t peak;
+    uint16_t peak_bin;
+    int8_t shift;
+};
+
+static generic_sensor_fft_cb_t m_window_done;
+
+/* cos and sin of 2 pi k / N, q15 */
+static int16_t m_cos[HALF];
+static int16_t m_sin[HALF];
+
+static struct k_spinlock m_lock;
+static uint16_t m_edges_hz[BANDS];
+static size_t m_edge_count;
+static uint8_t m_last[GENERIC_SENSOR_FFT_LEN];
+static bool m_have_last;
+
+/* Consumer thread fills one window while the FFT thread reads the other */
+static int16_t m_windows[2][CHANNELS][N];
+static uint32_t m_first_us[2];
+static uint32_t m_last_us[2];
+static uint8_t m_fill;
+static uint8_t m_ready;
+static uint16_t m_len;
+static atomic_t m_busy;
+static uint32_t m_overruns;
+static K_SEM_DEFINE(m_ready_sem, 0, 1);
+
+/* FFT thread, or the benchmark */
+static struct cpx m_buf[N];
+static uint8_t m_band_of_bin[HALF + 1];
+static uint16_t m_window;
+
+static int16_t q30_to_q15(int64_t v)
+{
+    v = (v + (1 << 14)) >> 15;
+
+    return CLAMP(v, INT16_MIN, INT16_MAX);
+}
+
+/*
+ * Rotate by one step of 2 pi / N in Q30. The step itself comes from a
+ * short Taylor series, exact to far below a q15 LSB for N >= 16.
+ */
+static void twiddle_init(void)
+{
+    const int64_t t = (TWO_PI_Q30 + HALF) / N;
+    const int64_t t2 = (t * t) >> 30;
+    const int64_t t4 = (t2 * t2) >> 30;
+    const int64_t c_step = (1LL << 30) - t2 / 2 + t4 / 24 -
+                           ((t4 * t2) >> 30) / 720;
+    const int64_t s_step = t - ((t * t2) >> 30) / 6 +
+                           ((t * t4) >> 30) / 120;
+    int64_t c = 1LL << 30;
+    int64_t s = 0;
+
+    for (int k = 0; k < HALF; k++) {
+        int64_t next_c = (c * c_step - s * s_step + (1LL << 29)) >> 30;
+        int64_t next_s = (s * c_step + c * s_step + (1LL << 29)) >> 30;
+
+        m_cos[k] = q30_to_q15(c);
+        m_sin[k] = q30_to_q15(s);
+        c = next_c;
+        s = next_s;
+    }
+}
+
+/* Hann window, q15 */
+static inline int32_t hann(int n)
+{
+    if (n > HALF) {
+        n = N - n;
+    }
+
+    return n == HALF ? INT16_MAX : (INT16_MAX - m_cos[n]) >> 1;
+}
+
+static inline int32_t windowed(const int16_t *x, int32_t mean, int n)
+{
+    return ((x[n] - mean) * hann(n)) >> 15;
+}
+
+/*
+ * Remove the mean, apply the window and scale to 14 bits into the real
+ * (lane 0) or imaginary (lane 1) part of the work buffer. Returns the
+ * left shift applied, negative for a right shift.
+ */
+static int prepare(const int16_t *x, int lane)
+{
+    int32_t sum = 0;
+    int32_t mean;
+    int32_t peak = 0;
+    int shift = 0;
+
+    for (int n = 0; n < N; n++) {
+        sum += x[n];
+    }
+    mean = (sum < 0 ? sum - HALF : sum + HALF) / N;
+
+    for (int n = 0; n < N; n++) {
+        peak = MAX(peak, abs(windowed(x, mean, n)));
+    }
+
+    if (peak) {
+        while ((peak << (shift + 1)) < (1 << 14)) {
+            shift++;
+        }
+        while ((peak >> -shift) >= (1 << 14)) {
+            shift--;
+        }
+    }
+
+    for (int n = 0; n < N; n++) {
+        int32_t v = windowed(x, mean, n);
+        int16_t *dst = lane ? &m_buf[n].im : &m_buf[n].re;
+
+        *dst = shift >= 0 ? v << shift : v >> -shift;
+    }
+
+    return shift;
+}
+
+/* In place, decimation in time, output scaled by 1 / N */
+static void fft(struct cpx *x)
+{
+    for (int i = 1, j = 0; i < N; i++) {
+        int bit = HALF;
+
+        for (; j & bit; bit >>= 1) {
+            j ^= bit;
+        }
+        j |= bit;
+
+        if (i < j) {
+            struct cpx tmp = x[i];
+
+            x[i] = x[j];
+            x[j] = tmp;
+        }
+    }
+
+    for (int size = 2; size <= N; size <<= 1) {
+        const int half = size / 2;
+        const int step = N / size;
+
+        for (int i = 0; i < N; i += size) {
+            for (int k = 0; k < half; k++) {
+                struct cpx *a = &x[i + k];
+                struct cpx *b = &x[i + k + half];
+                /* b * (cos - j sin) */
+                int32_t wr = m_cos[k * step];
+                int32_t wi = -m_sin[k * step];
+                int32_t tr = (b->re * wr - b->im * wi) >> 15;
+                int32_t ti = (b->re * wi + b->im * wr) >> 15;
+
+                b->re = (a->re - tr) >> 1;
+                b->im = (a->im - ti) >> 1;
+                a->re = (a->re + tr) >> 1;
+                a->im = (a->im + ti) >> 1;
+            }
+        }
+    }
+}
+
+/* 4 |A[k]|^2 and 4 |B[k]|^2 of the two real lanes a + jb */
+static void split(int k, uint64_t *pa, uint64_t *pb)
+{
+    const struct cpx *x = &m_buf[k & (N - 1)];
+    const struct cpx *y = &m_buf[(N - k) & (N - 1)];
+    int64_t ar = x->re + y->re;
+    int64_t ai = x->im - y->im;
+    int64_t br = x->im + y->im;
+    int64_t bi = y->re - x->re;
+
+    *pa = ar * ar + ai * ai;
+    *pb = br * br + bi * bi;
+}
+
+static inline uint64_t lane_power(int k, int lane)
+{
+    uint64_t pa, pb;
+
+    split(k, &pa, &pb);
+
+    return lane ? pb : pa;
+}
+
+static void band_init(uint32_t bin_mhz)
+{
+    uint16_t edges_hz[BANDS];
+    size_t count;
+    k_spinlock_key_t key = k_spin_lock(&m_lock);
+
+    count = m_edge_count;
+    memcpy(edges_hz, m_edges_hz, sizeof(edges_hz));
+    k_spin_unlock(&m_lock, key);
+
+    m_band_of_bin[0] = NO_BAND;
+    for (int k = 1, b = 0; k <= HALF; k++) {
+        if (!count) {
+            m_band_of_bin[k] = (k - 1) * BANDS / HALF;
+            continue;
+        }
+
+        while (b < count && (uint64_t)k * bin_mhz >= edges_hz[b] * 1000ULL) {
+            b++;
+        }
+        m_band_of_bin[k] = b < count ? b : NO_BAND;
+    }
+}
+
+static void accumulate(struct channel_spectrum *ch, int k, uint64_t p)
+{
+    if (m_band_of_bin[k] != NO_BAND) {
+        ch->energy[m_band_of_bin[k]] += p;
+    }
+    if (p > ch->peak) {
+        ch->peak = p;
+        ch->peak_bin = k;
+    }
+}
+
+/* Dominant frequency from a parabola through the peak and its neighbours */
+static uint32_t peak_mhz(const struct channel_spectrum *ch, int lane,
+                         uint64_t fs_mhz)
+{
+    int64_t left, right, curve;
+    int32_t frac = 0;
+
+    if (!ch->peak) {
+        return 0;
+    }
+
+    left = lane_power(ch->peak_bin - 1, lane);
+    right = lane_power(ch->peak_bin + 1, lane);
+    curve = left - 2 * (int64_t)ch->peak + right;
+    if (curve < 0) {
+        /* Offset from the peak bin in 1/256 bin */
+        frac = CLAMP((left - right) * 128 / curve, -128, 128);
+    }
+
+    return ((uint64_t)ch->peak_bin * 256 + frac) * fs_mhz / (N * 256ULL);
+}
+
+static uint8_t *put_channel(uint8_t *p, const struct channel_spectrum *ch,
+                            int lane, uint64_t fs_mhz)
+{
+    /* Undo the 4 from split() and the block scaling, keep 8 fraction bits */
+    const int scale = 6 - 2 * ch->shift;
+
+    sys_put_le32(peak_mhz(ch, lane, fs_mhz), p);
+    p += 4;
+
+    for (int b = 0; b < BANDS; b++) {
+        uint64_t e = scale >= 0 ? ch->energy[b] << scale :
+                                  ch->energy[b] >> -scale;
+
+        sys_put_le32(MIN(e, UINT32_MAX), p);
+        p += 4;
+    }
+
+    return p;
+}
+
+void generic_sensor_fft_compute(
+    const int16_t window[][CONFIG_GENERIC_SENSOR_FFT_SIZE],
+    uint32_t first_us, uint32_t last_us,
+    uint8_t summary[GENERIC_SENSOR_FFT_LEN])
+{
+    const uint32_t span_us = last_us - first_us;
+    const uint64_t fs_mhz = span_us ?
+                            (N - 1) * 1000000000ULL / span_us : 0;
+    const uint32_t bin_mhz = fs_mhz / N;
+    uint8_t *p = &summary[GENERIC_SENSOR_FFT_HDR_LEN];
+
+    sys_put_le16(m_window++, &summary[0]);
+    sys_put_le32(first_us, &summary[2]);
+    sys_put_le32(bin_mhz, &summary[6]);
+
+    band_init(bin_mhz);
+
+    for (int c = 0; c < CHANNELS; c += 2) {
+        struct channel_spectrum spec[2] = { 0 };
+        const bool pair = c + 1 < CHANNELS;
+
+        spec[0].shift = prepare(window[c], 0);
+        if (pair) {
+            spec[1].shift = prepare(window[c + 1], 1);
+        } else {
+            for (int n = 0; n < N; n++) {
+                m_buf[n].im = 0;
+            }
+        }
+
+        fft(m_buf);
+
+        for (int k = 1; k <= HALF; k++) {
+            uint64_t pa, pb;
+
+            split(k, &pa, &pb);
+            accumulate(&spec[0], k, pa);
+            accumulate(&spec[1], k, pb);
+        }
+
+        p = put_channel(p, &spec[0], 0, fs_mhz);
+        if (pair) {
+            p = put_channel(p, &spec[1], 1, fs_mhz);
+        }
+    }
+}
+
+static void fft_thread(void)
+{
+    uint8_t summary[GENERIC_SENSOR_FFT_LEN];
+    k_spinlock_key_t key;
+
+    while (1) {
+        k_sem_take(&m_ready_sem, K_FOREVER);
+
+        generic_sensor_fft_compute(m_windows[m_ready], m_first_us[m_ready],
+                                   m_last_us[m_ready], summary);
+        atomic_set(&m_busy, 0);
+
+        key = k_spin_lock(&m_lock);
+        memcpy(m_last, summary, sizeof(m_last));
+        m_have_last = true;
+        k_spin_unlock(&m_lock, key);
+
+        if (m_window_done) {
+            m_window_done(summary, sizeof(summary));
+        }
+    }
+}
+
+K_THREAD_DEFINE(fft_tid, FFT_THREAD_STACK_SIZE, fft_thread,
+                NULL, NULL, NULL, FFT_THREAD_PRIORITY, 0, 0);
+
+void generic_sensor_fft_init(generic_sensor_fft_cb_t window_done)
+{
+    twiddle_init();
+    m_window_done = window_done;
+}
+
+int generic_sensor_fft_set_bands(const uint16_t *edges_hz, size_t count)
+{
+    k_spinlock_key_t key;
+
+    if (count > BANDS) {
+        return -EINVAL;
+    }
+
+    for (size_t i = 1; i < count; i++) {
+        if (edges_hz[i] <= edges_hz[i - 1]) {
+            return -EINVAL;
+        }
+    }
+
+    key = k_spin_lock(&m_lock);
+    memcpy(m_edges_hz, edges_hz, count * sizeof(edges_hz[0]));
+    m_edge_count = count;
+    k_spin_unlock(&m_lock, key);
+
+    return 0;
+}
+
+size_t generic_sensor_fft_bands(uint16_t *edges_hz, size_t size)
+{
+    k_spinlock_key_t key = k_spin_lock(&m_lock);
+    size_t count = MIN(size, m_edge_count);
+
+    memcpy(edges_hz, m_edges_hz, count * sizeof(edges_hz[0]));
+    k_spin_unlock(&m_lock, key);
+
+    return count;
+}
+
+void generic_sensor_fft_add(const struct generic_sensor_frame *frame)
+{
+    if (!m_len) {
+        m_first_us[m_fill] = frame->timestamp_us;
+    }
+    m_last_us[m_fill] = frame->timestamp_us;
+
+    for (int c = 0; c < CHANNELS; c++) {
+        m_windows[m_fill][c][m_len] = frame->values[c];
+    }
+
+    if (++m_len < N) {
+        return;
+    }
+    m_len = 0;
+
+    /* Still busy with the last window: refill this one instead */
+    if (!atomic_cas(&m_busy, 0, 1)) {
+        m_overruns++;
+        return;
+    }
+
+    m_ready = m_fill;
+    m_fill ^= 1;
+    k_sem_give(&m_ready_sem);
+}
+
+size_t generic_sensor_fft_last(uint8_t *buf, size_t size)
+{
+    k_spinlock_key_t key = k_spin_lock(&m_lock);
+    size_t len = m_have_last ? MIN(size, sizeof(m_last)) : 0;
+
+    memcpy(buf, m_last, len);
+    k_spin_unlock(&m_lock, key);
+
+    return len;
+}
+
+uint32_t generic_sensor_fft_overruns(void)
+{
+    return m_overruns;
+}
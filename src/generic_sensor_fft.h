@@ -0,0 +1,90 @@
+/*
+ * Spectral features of the frame stream
+ *
+ * Sampled frames, in millivolts but not yet decimated, are collected into
+ * windows of CONFIG_GENERIC_SENSOR_FFT_SIZE frames. A full window is handed
+ * to a low priority thread, which runs a fixed-point FFT on every channel
+ * while the next window fills. It then reports the energy in each band and the
+ * dominant frequency. Sampling and the frame stream never wait for it; a
+ * window that completes while the previous one is still being transformed
+ * is skipped and counted.
+ *
+ * Summary layout (little endian):
+ *
+ *   uint16_t window        wraps, gaps mean windows were skipped or lost
+ *   uint32_t timestamp_us  device time of the first frame in the window
+ *   uint32_t bin_mhz       width of one frequency bin in mHz
+ *   per channel:
+ *     uint32_t peak_mhz    dominant frequency, interpolated between bins
+ *     uint32_t energy[CONFIG_GENERIC_SENSOR_FFT_BANDS]
+ *                          in 1/256 mV^2, saturating
+ *
+ * The energy of a band is the sum of |X[k] / N|^2 over its bins, with X
+ * the DFT of the Hann windowed frames, after the mean was removed. The DC
+ * bin is never part of a band.
+ */
+
+#include <stddef.h>
+#include <stdint.h>
+
+#include "generic_sensor_ring.h"
+
+#ifndef GENERIC_SENSOR_FFT__H
+#define GENERIC_SENSOR_FFT__H
+
+#define GENERIC_SENSOR_FFT_HDR_LEN      10
+#define GENERIC_SENSOR_FFT_CHANNEL_LEN  (4 + 4 * CONFIG_GENERIC_SENSOR_FFT_BANDS)
+#define GENERIC_SENSOR_FFT_LEN                                          \
+    (GENERIC_SENSOR_FFT_HDR_LEN +                                       \
+     GENERIC_SENSOR_ADC_CHANNELS * GENERIC_SENSOR_FFT_CHANNEL_LEN)
+
+/* Called on the FFT thread with every finished summary */
+typedef void (*generic_sensor_fft_cb_t)(const uint8_t *summary, uint16_t len);
+
+#ifdef CONFIG_GENERIC_SENSOR_FFT
+
+/* Build the twiddle tables, must run before the first frame */
+void generic_sensor_fft_init(generic_sensor_fft_cb_t window_done);
+
+/*
+ * Upper band edges in Hz, ascending, at most CONFIG_GENERIC_SENSOR_FFT_BANDS.
+ * Band i spans from edge i - 1 (0 Hz for the first) to edge i; bins above
+ * the last edge are not counted. With no edges the bins up to the Nyquist
+ * frequency are split evenly. Takes effect with the next window.
+ */
+int generic_sensor_fft_set_bands(const uint16_t *edges_hz, size_t count);
+size_t generic_sensor_fft_bands(uint16_t *edges_hz, size_t size);
+
+/* Add one frame of millivolts to the window, from the sampling thread */
+void generic_sensor_fft_add(const struct generic_sensor_frame *frame);
+
+/*
+ * Transform one window of frames, stored channel after channel, whose
+ * first and last frame were taken at first_us and last_us. Used by the
+ * FFT thread and the benchmark.
+ */
+void generic_sensor_fft_compute(
+    const int16_t window[][CONFIG_GENERIC_SENSOR_FFT_SIZE],
+    uint32_t first_us, uint32_t last_us,
+    uint8_t summary[GENERIC_SENSOR_FFT_LEN]);
+
+/* Copy of the last summary, 0 before the first window was transformed */
+size_t generic_sensor_fft_last(uint8_t *buf, size_t size);
+
+/* Windows skipped because the previous one was still being transformed */
+uint32_t generic_sensor_fft_overruns(void);
+
+#else
+
+static inline void generic_sensor_fft_init(generic_sensor_fft_cb_t window_done)
+{
+}
+
+static inline void generic_sensor_fft_add(
+    const struct generic_sensor_frame *frame)
+{
+}
+
+#endif
+
+#endif
@@ -0,0 +1,175 @@
+/*
+ * Streaming decimation filters between acquisition and output
+ *
+ * Every filter works incrementally on one frame at a time, so the ADC can
+ * run continuously and the cost per frame stays constant whatever the
+ * decimation ratio. All arithmetic is integer.
+ */
+
+#include "generic_sensor_filter.h"
+#include "generic_sensor_adc.h"
+#include "generic_sensor_math.h"
+
+#include <errno.h>
+#include <zephyr.h>
+
+/* ESS Measurement descriptor sampling functions */
+#define SAMPLING_FUNC_UNSPECIFIED       0x00
+#define SAMPLING_FUNC_INSTANTANEOUS     0x01
+#define SAMPLING_FUNC_ARITHMETIC_MEAN   0x02
+
+/* IIR state keeps this many fractional bits */
+#define IIR_FRAC_BITS                   8
+
+#define CHANNELS                        GENERIC_SENSOR_ADC_CHANNELS
+
+static struct generic_sensor_filter_cfg m_cfg = {
+    .type = GENERIC_SENSOR_FILTER_NONE,
+    .ratio = 1,
+};
+static struct generic_sensor_filter_cfg m_pending;
+static atomic_t m_reconfigure;
+static struct k_spinlock m_lock;
+
+static uint16_t m_phase;
+static uint8_t m_iir_shift;
+/* Integrators and combs wrap on purpose, the CIC output is still exact */
+static uint32_t m_acc[CHANNELS];
+static uint32_t m_acc2[CHANNELS];
+static uint32_t m_comb[CHANNELS];
+static uint32_t m_comb2[CHANNELS];
+static int32_t m_iir[CHANNELS];
+static bool m_iir_primed;
+
+static void filter_reset(void)
+{
+    m_phase = 0;
+    m_iir_primed = false;
+    m_iir_shift = 0;
+    while ((1U << (m_iir_shift + 1)) <= m_cfg.ratio) {
+        m_iir_shift++;
+    }
+
+    for (int i = 0; i < CHANNELS; i++) {
+        m_acc[i] = 0;
+        m_acc2[i] = 0;
+        m_comb[i] = 0;
+        m_comb2[i] = 0;
+        m_iir[i] = 0;
+    }
+}
+
+int generic_sensor_filter_configure(const struct generic_sensor_filter_cfg *cfg)
+{
+    k_spinlock_key_t key;
+
+    if (cfg->type > GENERIC_SENSOR_FILTER_IIR || !cfg->ratio ||
+        cfg->ratio > GENERIC_SENSOR_FILTER_MAX_RATIO) {
+        return -EINVAL;
+    }
+
+    key = k_spin_lock(&m_lock);
+    m_pending = *cfg;
+    atomic_set(&m_reconfigure, 1);
+    k_spin_unlock(&m_lock, key);
+
+    return 0;
+}
+
+void generic_sensor_filter_get_config(struct generic_sensor_filter_cfg *cfg)
+{
+    k_spinlock_key_t key = k_spin_lock(&m_lock);
+
+    *cfg = atomic_get(&m_reconfigure) ? m_pending : m_cfg;
+    k_spin_unlock(&m_lock, key);
+}
+
+uint8_t generic_sensor_filter_sampling_func(uint8_t type)
+{
+    switch (type) {
+    case GENERIC_SENSOR_FILTER_NONE:
+        return SAMPLING_FUNC_INSTANTANEOUS;
+    case GENERIC_SENSOR_FILTER_MOVING_AVERAGE:
+    case GENERIC_SENSOR_FILTER_CIC:
+        return SAMPLING_FUNC_ARITHMETIC_MEAN;
+    default:
+        return SAMPLING_FUNC_UNSPECIFIED;
+    }
+}
+
+bool generic_sensor_filter_feed(const int16_t in[], int16_t out[])
+{
+    bool dump;
+
+    if (atomic_get(&m_reconfigure)) {
+        k_spinlock_key_t key = k_spin_lock(&m_lock);
+
+        m_cfg = m_pending;
+        atomic_set(&m_reconfigure, 0);
+        k_spin_unlock(&m_lock, key);
+        filter_reset();
+    }
+
+    dump = ++m_phase >= m_cfg.ratio;
+    if (dump) {
+        m_phase = 0;
+    }
+
+    switch (m_cfg.type) {
+    case GENERIC_SENSOR_FILTER_MOVING_AVERAGE:
+        for (int i = 0; i < CHANNELS; i++) {
+            m_acc[i] += in[i];
+            if (dump) {
+                out[i] = generic_sensor_div_round((int32_t)m_acc[i],
+                                                  m_cfg.ratio);
+                m_acc[i] = 0;
+            }
+        }
+        break;
+
+    case GENERIC_SENSOR_FILTER_CIC:
+        for (int i = 0; i < CHANNELS; i++) {
+            /* Integrators at the input rate */
+            m_acc[i] += (uint32_t)(int32_t)in[i];
+            m_acc2[i] += m_acc[i];
+            if (dump) {
+                /* Combs at the output rate, DC gain is R^2 */
+                uint32_t c1 = m_acc2[i] - m_comb[i];
+                uint32_t c2 = c1 - m_comb2[i];
+
+                m_comb[i] = m_acc2[i];
+                m_comb2[i] = c1;
+                out[i] = generic_sensor_div_round(
+                    (int32_t)c2, (uint32_t)m_cfg.ratio * m_cfg.ratio);
+            }
+        }
+        break;
+
+    case GENERIC_SENSOR_FILTER_IIR:
+        for (int i = 0; i < CHANNELS; i++) {
+            int32_t x = (int32_t)in[i] << IIR_FRAC_BITS;
+
+            if (!m_iir_primed) {
+                m_iir[i] = x;
+            } else {
+                m_iir[i] += (x - m_iir[i]) >> m_iir_shift;
+            }
+            if (dump) {
+                out[i] = (m_iir[i] + (1 << (IIR_FRAC_BITS - 1))) >>
+                         IIR_FRAC_BITS;
+            }
+        }
+        m_iir_primed = true;
+        break;
+
+    default:
+        if (dump) {
+            for (int i = 0; i < CHANNELS; i++) {
+                out[i] = in[i];
+            }
+        }
+        break;
+    }
+
+    return dump;
+}
@@ -0,0 +1,45 @@
+/*
+ * Streaming decimation filters between acquisition and output
+ */
+
+#include <stdbool.h>
+#include <stdint.h>
+
+#ifndef GENERIC_SENSOR_FILTER__H
+#define GENERIC_SENSOR_FILTER__H
+
+enum generic_sensor_filter_type {
+    /* Pass every R-th frame through unfiltered */
+    GENERIC_SENSOR_FILTER_NONE = 0x00,
+    /* Running sum over R frames, dumped as their mean */
+    GENERIC_SENSOR_FILTER_MOVING_AVERAGE = 0x01,
+    /* Second order CIC decimator by R */
+    GENERIC_SENSOR_FILTER_CIC = 0x02,
+    /* First order IIR low pass, time constant ~R frames, decimated by R */
+    GENERIC_SENSOR_FILTER_IIR = 0x03,
+};
+
+#define GENERIC_SENSOR_FILTER_MAX_RATIO 64
+
+struct generic_sensor_filter_cfg {
+    uint8_t type;
+    uint16_t ratio;
+};
+
+/*
+ * Takes effect at the next frame fed to the filter. Returns -EINVAL for an
+ * unknown type or a ratio outside 1..GENERIC_SENSOR_FILTER_MAX_RATIO.
+ */
+int generic_sensor_filter_configure(const struct generic_sensor_filter_cfg *cfg);
+void generic_sensor_filter_get_config(struct generic_sensor_filter_cfg *cfg);
+
+/* ESS Measurement descriptor sampling function for a filter type */
+uint8_t generic_sensor_filter_sampling_func(uint8_t type);
+
+/*
+ * Feed one frame of raw codes. Returns true when a decimated frame, in the
+ * same units, was written to out.
+ */
+bool generic_sensor_filter_feed(const int16_t in[], int16_t out[]);
+
+#endif
@@ -0,0 +1,309 @@
+/*
+ * Sensor frame streaming over L2CAP connection oriented channels
+ *
+ * Every connection may open one channel. Frames are encoded straight into
+ * the SDU buffer, which goes to the stack once the next worst-case frame
+ * might not fit or its oldest frame has waited the configured latency.
+ */
+
+#include "generic_sensor_l2cap.h"
+#include "generic_sensor_conn.h"
+#include "generic_sensor_encode.h"
+#include "generic_sensor_metrics.h"
+
+#include <errno.h>
+#include <string.h>
+#include <zephyr.h>
+#include <sys/atomic.h>
+#include <sys/byteorder.h>
+#include <net/buf.h>
+#include <bluetooth/bluetooth.h>
+#include <bluetooth/conn.h>
+#include <bluetooth/l2cap.h>
+#include <logging/log.h>
+
+LOG_MODULE_REGISTER(generic_sensor_l2cap, CONFIG_GENERIC_SENSOR_LOG_LEVEL);
+
+#define SDU_LEN                 CONFIG_GENERIC_SENSOR_L2CAP_SDU_LEN
+/* Sent plus filling per channel, more only adds latency */
+#define SDU_COUNT               (2 * CONFIG_BT_MAX_CONN)
+
+BUILD_ASSERT(SDU_LEN >= GENERIC_SENSOR_L2CAP_HDR_LEN +
+             GENERIC_SENSOR_ADC_CHANNELS * sizeof(int16_t),
+             "L2CAP SDU too small for a single frame");
+
+NET_BUF_POOL_FIXED_DEFINE(m_sdu_pool, SDU_COUNT, BT_L2CAP_SDU_BUF_SIZE(SDU_LEN),
+                          NULL);
+
+struct l2cap_stream {
+    struct bt_l2cap_le_chan chan;
+    bool open;
+
+    /* Guards the SDU being filled against the deadline work */
+    struct k_mutex lock;
+    struct k_work_delayable deadline_work;
+    struct net_buf *sdu;
+    uint8_t *hdr;
+    struct generic_sensor_encoder enc;
+    uint16_t count;
+    uint16_t next_seq;
+    uint32_t dropped;
+};
+
+static struct l2cap_stream m_streams[CONFIG_BT_MAX_CONN];
+static atomic_t m_open;
+static generic_sensor_l2cap_cb_t m_channel_changed;
+
+/* Must be called with s->lock held */
+static void stream_send(struct l2cap_stream *s)
+{
+    struct net_buf *buf = s->sdu;
+    uint16_t count = s->count;
+    int err;
+
+    if (!buf) {
+        return;
+    }
+
+    k_work_cancel_delayable(&s->deadline_work);
+    s->sdu = NULL;
+    s->count = 0;
+
+    sys_put_le16(count, &s->hdr[1]);
+    net_buf_add(buf, generic_sensor_encoder_finish(&s->enc));
+
+    /* Waits in the channel's queue while the central has no credits */
+    err = bt_l2cap_chan_send(&s->chan.chan, buf);
+    if (err < 0) {
+        net_buf_unref(buf);
+        s->dropped += count;
+        LOG_DBG("SDU of %u frames dropped (err %d)", count, err);
+        return;
+    }
+
+    generic_sensor_metrics_count(GENERIC_SENSOR_CNT_FRAMES_SENT, count);
+}
+
+/* Must be called with s->lock held */
+static int stream_open_sdu(struct l2cap_stream *s,
+                           const struct generic_sensor_frame *frame)
+{
+    struct generic_sensor_conn *gc = generic_sensor_conn_get(s->chan.chan.conn);
+    uint8_t encoding = gc ? gc->encoding : GENERIC_SENSOR_ENC_RAW16;
+    size_t len = MIN(SDU_LEN, s->chan.tx.mtu);
+
+    if (len < GENERIC_SENSOR_L2CAP_HDR_LEN +
+        generic_sensor_encode_max_frame_len(encoding,
+                                            GENERIC_SENSOR_ADC_CHANNELS)) {
+        return -EMSGSIZE;
+    }
+
+    s->sdu = net_buf_alloc(&m_sdu_pool, K_NO_WAIT);
+    if (!s->sdu) {
+        return -ENOMEM;
+    }
+    generic_sensor_metrics_count(GENERIC_SENSOR_CNT_ALLOCS, 1);
+    net_buf_reserve(s->sdu, BT_L2CAP_SDU_CHAN_SEND_RESERVE);
+
+    s->hdr = net_buf_add(s->sdu, GENERIC_SENSOR_L2CAP_HDR_LEN);
+    s->hdr[0] = encoding;
+    sys_put_le16(frame->seq, &s->hdr[3]);
+    sys_put_le32(frame->timestamp_us, &s->hdr[5]);
+
+    generic_sensor_encoder_init(&s->enc, encoding, GENERIC_SENSOR_ADC_CHANNELS,
+                                net_buf_tail(s->sdu),
+                                len - GENERIC_SENSOR_L2CAP_HDR_LEN);
+    k_work_schedule(&s->deadline_work,
+                    K_MSEC(CONFIG_GENERIC_SENSOR_L2CAP_LATENCY_MS));
+
+    return 0;
+}
+
+static void stream_add(struct l2cap_stream *s,
+                       const struct generic_sensor_frame *frame)
+{
+    uint32_t start;
+
+    k_mutex_lock(&s->lock, K_FOREVER);
+
+    if (!s->open) {
+        goto unlock;
+    }
+
+    /* An SDU only describes consecutive frames, close it on a gap */
+    if (s->sdu && frame->seq != s->next_seq) {
+        stream_send(s);
+    }
+
+    /* Every SDU is queued or in flight: the central is too slow */
+    if (!s->sdu && stream_open_sdu(s, frame)) {
+        s->dropped++;
+        goto unlock;
+    }
+
+    start = generic_sensor_metrics_start();
+    if (generic_sensor_encoder_add(&s->enc, frame->values)) {
+        stream_send(s);
+        if (stream_open_sdu(s, frame)) {
+            s->dropped++;
+            goto unlock;
+        }
+        start = generic_sensor_metrics_start();
+        generic_sensor_encoder_add(&s->enc, frame->values);
+    }
+    generic_sensor_metrics_stage(GENERIC_SENSOR_STAGE_ENCODE, start);
+
+    s->count++;
+    s->next_seq = frame->seq + 1;
+
+    if (s->count == UINT16_MAX ||
+        s->enc.size - s->enc.len <
+        generic_sensor_encode_max_frame_len(s->enc.format,
+                                            GENERIC_SENSOR_ADC_CHANNELS)) {
+        stream_send(s);
+    }
+
+unlock:
+    k_mutex_unlock(&s->lock);
+}
+
+static void deadline_work_handler(struct k_work *work)
+{
+    struct k_work_delayable *dwork = k_work_delayable_from_work(work);
+    struct l2cap_stream *s =
+        CONTAINER_OF(dwork, struct l2cap_stream, deadline_work);
+
+    k_mutex_lock(&s->lock, K_FOREVER);
+    stream_send(s);
+    k_mutex_unlock(&s->lock);
+}
+
+static void chan_connected(struct bt_l2cap_chan *chan)
+{
+    struct l2cap_stream *s = CONTAINER_OF(chan, struct l2cap_stream, chan.chan);
+
+    LOG_INF("L2CAP channel open, tx MTU %u MPS %u",
+            s->chan.tx.mtu, s->chan.tx.mps);
+
+    k_mutex_lock(&s->lock, K_FOREVER);
+    s->open = true;
+    s->dropped = 0;
+    k_mutex_unlock(&s->lock);
+
+    atomic_inc(&m_open);
+    if (m_channel_changed) {
+        m_channel_changed(chan->conn, true);
+    }
+}
+
+static void chan_disconnected(struct bt_l2cap_chan *chan)
+{
+    struct l2cap_stream *s = CONTAINER_OF(chan, struct l2cap_stream, chan.chan);
+    bool was_open;
+
+    k_mutex_lock(&s->lock, K_FOREVER);
+    was_open = s->open;
+    s->open = false;
+    k_work_cancel_delayable(&s->deadline_work);
+    if (s->sdu) {
+        net_buf_unref(s->sdu);
+        s->sdu = NULL;
+        s->count = 0;
+    }
+    k_mutex_unlock(&s->lock);
+
+    /* Also called when the channel failed to connect */
+    if (!was_open) {
+        return;
+    }
+
+    LOG_INF("L2CAP channel closed, %u frames dropped", s->dropped);
+
+    atomic_dec(&m_open);
+    if (m_channel_changed) {
+        m_channel_changed(chan->conn, false);
+    }
+}
+
+/* The stream is one way, whatever the central sends is ignored */
+static int chan_recv(struct bt_l2cap_chan *chan, struct net_buf *buf)
+{
+    return 0;
+}
+
+static struct bt_l2cap_chan_ops m_chan_ops = {
+    .connected = chan_connected,
+    .disconnected = chan_disconnected,
+    .recv = chan_recv,
+};
+
+static int stream_accept(struct bt_conn *conn, struct bt_l2cap_chan **chan)
+{
+    struct l2cap_stream *s = &m_streams[bt_conn_index(conn)];
+
+    if (s->chan.chan.conn) {
+        LOG_WRN("L2CAP channel already open on this connection");
+        return -ENOMEM;
+    }
+
+    memset(&s->chan, 0, sizeof(s->chan));
+    s->chan.chan.ops = &m_chan_ops;
+    *chan = &s->chan.chan;
+
+    return 0;
+}
+
+static struct bt_l2cap_server m_server = {
+    .accept = stream_accept,
+    .sec_level = BT_SECURITY_L1,
+};
+
+int generic_sensor_l2cap_init(generic_sensor_l2cap_cb_t channel_changed)
+{
+    int err;
+
+    m_channel_changed = channel_changed;
+
+    for (int i = 0; i < ARRAY_SIZE(m_streams); i++) {
+        k_mutex_init(&m_streams[i].lock);
+        k_work_init_delayable(&m_streams[i].deadline_work,
+                              deadline_work_handler);
+    }
+
+    /* PSM 0 lets the stack pick a free dynamic one */
+    err = bt_l2cap_server_register(&m_server);
+    if (err) {
+        LOG_ERR("L2CAP server registration failed (err %d)", err);
+        return err;
+    }
+
+    LOG_INF("L2CAP stream on PSM 0x%04x", m_server.psm);
+
+    return 0;
+}
+
+uint16_t generic_sensor_l2cap_psm(void)
+{
+    return m_server.psm;
+}
+
+bool generic_sensor_l2cap_active(void)
+{
+    return atomic_get(&m_open) > 0;
+}
+
+bool generic_sensor_l2cap_is_open(struct bt_conn *conn)
+{
+    return conn && m_streams[bt_conn_index(conn)].open;
+}
+
+void generic_sensor_l2cap_add(const struct generic_sensor_frame *frame)
+{
+    if (!generic_sensor_l2cap_active()) {
+        return;
+    }
+
+    for (int i = 0; i < ARRAY_SIZE(m_streams); i++) {
+        stream_add(&m_streams[i], frame);
+    }
+}
@@ -0,0 +1,81 @@
+/*
+ * Sensor frame streaming over L2CAP connection oriented channels
+ *
+ * A central reads the PSM from the GATT service and opens an LE credit
+ * based channel on it. From then on it receives every frame the ring
+ * delivers, packed into SDUs of up to CONFIG_GENERIC_SENSOR_L2CAP_SDU_LEN
+ * bytes in the encoding selected for its connection. Flow control is the
+ * channel's credits: SDUs the central has no credits for wait in a small
+ * pool, frames that find the pool empty are dropped and show up as a gap
+ * in the sequence numbers.
+ *
+ * SDU layout (little endian):
+ *
+ *   uint8_t  encoding      wire encoding of the frames
+ *   uint16_t count         frames in the SDU
+ *   uint16_t first_seq     sequence number of the first frame
+ *   uint32_t timestamp_us  uptime at which the first frame was converted
+ *   frames[count]
+ */
+
+#include <stdbool.h>
+#include <stdint.h>
+#include <bluetooth/conn.h>
+
+#include "generic_sensor_ring.h"
+
+#ifndef GENERIC_SENSOR_L2CAP__H
+#define GENERIC_SENSOR_L2CAP__H
+
+#define GENERIC_SENSOR_L2CAP_HDR_LEN    9
+
+/* Called from the Bluetooth thread whenever a channel opens or closes */
+typedef void (*generic_sensor_l2cap_cb_t)(struct bt_conn *conn, bool open);
+
+#ifdef CONFIG_GENERIC_SENSOR_L2CAP
+
+/* Register the server, the PSM is allocated by the stack */
+int generic_sensor_l2cap_init(generic_sensor_l2cap_cb_t channel_changed);
+
+uint16_t generic_sensor_l2cap_psm(void);
+
+/* True while at least one channel is open */
+bool generic_sensor_l2cap_active(void);
+
+/* True while conn has its channel open */
+bool generic_sensor_l2cap_is_open(struct bt_conn *conn);
+
+/* Consumer side of the ring: queue one frame on every open channel */
+void generic_sensor_l2cap_add(const struct generic_sensor_frame *frame);
+
+#else
+
+static inline int generic_sensor_l2cap_init(
+    generic_sensor_l2cap_cb_t channel_changed)
+{
+    return 0;
+}
+
+static inline uint16_t generic_sensor_l2cap_psm(void)
+{
+    return 0;
+}
+
+static inline bool generic_sensor_l2cap_active(void)
+{
+    return false;
+}
+
+static inline bool generic_sensor_l2cap_is_open(struct bt_conn *conn)
+{
+    return false;
+}
+
+static inline void generic_sensor_l2cap_add(
+    const struct generic_sensor_frame *frame)
+{
+}
+
+#endif
+
+#endif
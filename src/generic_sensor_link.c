@@ -0,0 +1,209 @@
+/*
+ * Link tuning for sensor streaming
+ *
+ * The central has the last word on every parameter, the values granted are
+ * tracked from the update callbacks and reported in the snapshot.
+ */
+
+#include "generic_sensor_link.h"
+
+#include <errno.h>
+#include <zephyr.h>
+#include <sys/byteorder.h>
+#include <bluetooth/bluetooth.h>
+#include <bluetooth/conn.h>
+#include <bluetooth/gatt.h>
+#include <logging/log.h>
+
+LOG_MODULE_REGISTER(generic_sensor_link, CONFIG_GENERIC_SENSOR_LOG_LEVEL);
+
+/* Connection interval limits while streaming [1.25 ms] */
+#define STREAM_INTERVAL_MIN     6       /* 7.5 ms, the spec minimum */
+#define STREAM_INTERVAL_MAX     80      /* 100 ms */
+#define STREAM_TIMEOUT          400     /* 4 s [10 ms] */
+
+/* Idle link: long interval, and the peripheral may skip events */
+#define IDLE_INTERVAL_MIN       80      /* 100 ms */
+#define IDLE_INTERVAL_MAX       160     /* 200 ms */
+#define IDLE_LATENCY            4
+#define IDLE_TIMEOUT            600     /* 6 s [10 ms] */
+
+#define INTERVAL_UNIT_US        1250
+
+struct link_state {
+    struct bt_gatt_exchange_params mtu_params;
+    /* MTU, data length and PHY are asked for once per connection */
+    bool negotiated;
+    /* Maximum interval requested for streaming, 0 while idle */
+    uint16_t interval;
+    uint16_t tx_len;
+    uint16_t rx_len;
+    uint8_t tx_phy;
+    uint8_t rx_phy;
+};
+
+static struct link_state m_links[CONFIG_BT_MAX_CONN];
+
+static void mtu_exchanged(struct bt_conn *conn, uint8_t err,
+                          struct bt_gatt_exchange_params *params)
+{
+    if (err) {
+        LOG_WRN("MTU exchange failed (err %u)", err);
+    } else {
+        LOG_INF("MTU exchanged: %u", bt_gatt_get_mtu(conn));
+    }
+}
+
+static void link_connected(struct bt_conn *conn, uint8_t err)
+{
+    struct link_state *st = &m_links[bt_conn_index(conn)];
+
+    if (err) {
+        return;
+    }
+
+    st->negotiated = false;
+    st->interval = 0;
+    st->tx_len = BT_GAP_DATA_LEN_DEFAULT;
+    st->rx_len = BT_GAP_DATA_LEN_DEFAULT;
+    st->tx_phy = BT_GAP_LE_PHY_1M;
+    st->rx_phy = BT_GAP_LE_PHY_1M;
+}
+
+static void link_param_updated(struct bt_conn *conn, uint16_t interval,
+                               uint16_t latency, uint16_t timeout)
+{
+    LOG_INF("Connection interval %u.%02u ms, latency %u, timeout %u ms",
+            interval * 5 / 4, interval * 125 % 100, latency, timeout * 10);
+}
+
+static void link_phy_updated(struct bt_conn *conn,
+                             struct bt_conn_le_phy_info *param)
+{
+    struct link_state *st = &m_links[bt_conn_index(conn)];
+
+    st->tx_phy = param->tx_phy;
+    st->rx_phy = param->rx_phy;
+    LOG_INF("PHY tx %u rx %u", param->tx_phy, param->rx_phy);
+}
+
+static void link_data_len_updated(struct bt_conn *conn,
+                                  struct bt_conn_le_data_len_info *info)
+{
+    struct link_state *st = &m_links[bt_conn_index(conn)];
+
+    st->tx_len = info->tx_max_len;
+    st->rx_len = info->rx_max_len;
+    LOG_INF("Data length tx %u rx %u", info->tx_max_len, info->rx_max_len);
+}
+
+static struct bt_conn_cb m_conn_callbacks = {
+    .connected = link_connected,
+    .le_param_updated = link_param_updated,
+    .le_phy_updated = link_phy_updated,
+    .le_data_len_updated = link_data_len_updated,
+};
+
+void generic_sensor_link_init(void)
+{
+    bt_conn_cb_register(&m_conn_callbacks);
+}
+
+static void link_negotiate(struct bt_conn *conn, struct link_state *st)
+{
+    int err;
+
+    st->negotiated = true;
+
+    /* Fails harmlessly if the central exchanged the MTU already */
+    st->mtu_params.func = mtu_exchanged;
+    err = bt_gatt_exchange_mtu(conn, &st->mtu_params);
+    if (err && err != -EALREADY) {
+        LOG_WRN("MTU exchange not started (err %d)", err);
+    }
+
+    err = bt_conn_le_data_len_update(conn, BT_LE_DATA_LEN_PARAM_MAX);
+    if (err) {
+        LOG_WRN("Data length update failed (err %d)", err);
+    }
+
+    err = bt_conn_le_phy_update(conn, BT_CONN_LE_PHY_PARAM_2M);
+    if (err) {
+        LOG_WRN("PHY update failed (err %d)", err);
+    }
+}
+
+void generic_sensor_link_stream(struct bt_conn *conn,
+                                uint32_t packet_interval_us)
+{
+    struct link_state *st = &m_links[bt_conn_index(conn)];
+    uint16_t interval;
+    int err;
+
+    if (!st->negotiated) {
+        link_negotiate(conn, st);
+    }
+
+    /* At least one connection event per packet, latency never adds to it */
+    interval = CLAMP(packet_interval_us / INTERVAL_UNIT_US,
+                     STREAM_INTERVAL_MIN, STREAM_INTERVAL_MAX);
+    if (interval == st->interval) {
+        return;
+    }
+
+    /* A range leaves the central room to fit its other links */
+    err = bt_conn_le_param_update(conn,
+            BT_LE_CONN_PARAM(MAX(interval / 2, STREAM_INTERVAL_MIN),
+                             interval, 0, STREAM_TIMEOUT));
+    if (err) {
+        LOG_WRN("Connection parameter update failed (err %d)", err);
+        return;
+    }
+
+    st->interval = interval;
+}
+
+void generic_sensor_link_relax(struct bt_conn *conn)
+{
+    struct link_state *st = &m_links[bt_conn_index(conn)];
+    int err;
+
+    if (!st->interval) {
+        return;
+    }
+
+    err = bt_conn_le_param_update(conn,
+            BT_LE_CONN_PARAM(IDLE_INTERVAL_MIN, IDLE_INTERVAL_MAX,
+                             IDLE_LATENCY, IDLE_TIMEOUT));
+    if (err) {
+        LOG_WRN("Connection parameter update failed (err %d)", err);
+        return;
+    }
+
+    st->interval = 0;
+}
+
+size_t generic_sensor_link_snapshot(struct bt_conn *conn, uint8_t *buf,
+                                    size_t size)
+{
+    struct link_state *st;
+    struct bt_conn_info info;
+
+    if (size < GENERIC_SENSOR_LINK_LEN || !conn ||
+        bt_conn_get_info(conn, &info)) {
+        return 0;
+    }
+
+    st = &m_links[bt_conn_index(conn)];
+
+    sys_put_le16(info.le.interval, &buf[0]);
+    sys_put_le16(info.le.latency, &buf[2]);
+    sys_put_le16(info.le.timeout, &buf[4]);
+    sys_put_le16(bt_gatt_get_mtu(conn), &buf[6]);
+    sys_put_le16(st->tx_len, &buf[8]);
+    sys_put_le16(st->rx_len, &buf[10]);
+    buf[12] = st->tx_phy;
+    buf[13] = st->rx_phy;
+
+    return GENERIC_SENSOR_LINK_LEN;
+}
@@ -0,0 +1,70 @@
+/*
+ * Link tuning for sensor streaming
+ *
+ * While a connection streams, ask for the largest ATT MTU and LL data
+ * length, the 2M PHY and a connection interval short enough to carry
+ * every packet as it is produced. Once it stops, fall back to a long
+ * interval with peripheral latency so an idle link costs little power.
+ */
+
+#include <stddef.h>
+#include <stdint.h>
+#include <bluetooth/conn.h>
+
+#ifndef GENERIC_SENSOR_LINK__H
+#define GENERIC_SENSOR_LINK__H
+
+/*
+ * Link snapshot layout (little endian):
+ *
+ *   uint16_t interval      connection interval [1.25 ms]
+ *   uint16_t latency       peripheral latency [events]
+ *   uint16_t timeout       supervision timeout [10 ms]
+ *   uint16_t mtu           ATT MTU
+ *   uint16_t tx_len        LL payload octets, peripheral to central
+ *   uint16_t rx_len        LL payload octets, central to peripheral
+ *   uint8_t  tx_phy        BT_GAP_LE_PHY_* peripheral to central
+ *   uint8_t  rx_phy        BT_GAP_LE_PHY_* central to peripheral
+ */
+#define GENERIC_SENSOR_LINK_LEN         14
+
+#ifdef CONFIG_GENERIC_SENSOR_LINK
+
+/* Registers for the connection events, call after bt_enable() */
+void generic_sensor_link_init(void);
+
+/* Tune conn for one packet every packet_interval_us */
+void generic_sensor_link_stream(struct bt_conn *conn,
+                                uint32_t packet_interval_us);
+
+/* Give back the streaming parameters, if they were requested */
+void generic_sensor_link_relax(struct bt_conn *conn);
+
+/* Returns the length written, 0 if buf is too small */
+size_t generic_sensor_link_snapshot(struct bt_conn *conn, uint8_t *buf,
+                                    size_t size);
+
+#else
+
+static inline void generic_sensor_link_init(void)
+{
+}
+
+static inline void generic_sensor_link_stream(struct bt_conn *conn,
+                                              uint32_t packet_interval_us)
+{
+}
+
+static inline void generic_sensor_link_relax(struct bt_conn *conn)
+{
+}
+
+static inline size_t generic_sensor_link_snapshot(struct bt_conn *conn,
+                                                  uint8_t *buf, size_t size)
+{
+    return 0;
+}
+
+#endif
+
+#endif
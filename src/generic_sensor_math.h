@@ -0,0 +1,30 @@
+/*
+ * Integer helpers shared by the sampling path
+ */
+
+#include <stdint.h>
+
+#ifndef GENERIC_SENSOR_MATH__H
+#define GENERIC_SENSOR_MATH__H
+
+/* Rounded sum / n, half away from zero, a shift when n is a power of two */
+static inline int32_t generic_sensor_div_round(int32_t sum, uint32_t n)
+{
+    if ((n & (n - 1)) == 0) {
+        uint32_t shift = __builtin_ctz(n);
+        int32_t half;
+
+        if (!shift) {
+            return sum;
+        }
+
+        /* An arithmetic shift floors, so round the magnitude instead */
+        half = 1 << (shift - 1);
+        return sum < 0 ? -((half - sum) >> shift) : (sum + half) >> shift;
+    }
+
+    return (sum < 0 ? sum - (int32_t)(n / 2) : sum + (int32_t)(n / 2)) /
+           (int32_t)n;
+}
+
+#endif
@@ -0,0 +1,223 @@
+/*
+ * Pipeline metrics
+ *
+ * Every update is a handful of atomic operations, so stages can record
+ * from the ADC callback, the sampling thread and the transmit thread
+ * alike without a lock. A snapshot taken while stages record may mix
+ * adjacent updates, which is fine for diagnostics.
+ */
+
+#include "generic_sensor_metrics.h"
+#include "generic_sensor_ring.h"
+
+#include <init.h>
+#include <string.h>
+#include <sys/atomic.h>
+#include <sys/byteorder.h>
+#include <sys/printk.h>
+#include <zephyr.h>
+
+struct stage_hist {
+    atomic_t calls;
+    atomic_t max;
+    atomic_t bucket[GENERIC_SENSOR_METRICS_BUCKETS];
+};
+
+static struct stage_hist m_stages[GENERIC_SENSOR_STAGE_COUNT];
+static atomic_t m_counters[GENERIC_SENSOR_CNT_COUNT];
+static uint8_t m_min_shift;
+
+static inline int cycles_bucket(uint32_t cycles)
+{
+    int bucket;
+
+    if (cycles < (1U << m_min_shift)) {
+        return 0;
+    }
+
+    /* Index of the highest set bit, counted from the first bucket bound */
+    bucket = 32 - __builtin_clz(cycles) - m_min_shift;
+
+    return MIN(bucket, GENERIC_SENSOR_METRICS_BUCKETS - 1);
+}
+
+void generic_sensor_metrics_stage(enum generic_sensor_stage stage,
+                                  uint32_t start)
+{
+    struct stage_hist *hist = &m_stages[stage];
+    uint32_t cycles = generic_cycles_get() - start;
+    atomic_val_t max;
+
+    atomic_inc(&hist->calls);
+    atomic_inc(&hist->bucket[cycles_bucket(cycles)]);
+
+    do {
+        max = atomic_get(&hist->max);
+        if (cycles <= (uint32_t)max) {
+            break;
+        }
+    } while (!atomic_cas(&hist->max, max, cycles));
+}
+
+void generic_sensor_metrics_count(enum generic_sensor_counter counter,
+                                  uint32_t n)
+{
+    atomic_add(&m_counters[counter], n);
+}
+
+size_t generic_sensor_metrics_snapshot(uint8_t *buf, size_t size)
+{
+    uint8_t *p = buf;
+
+    if (size < GENERIC_SENSOR_METRICS_LEN) {
+        return 0;
+    }
+
+    *p++ = GENERIC_SENSOR_METRICS_VERSION;
+    *p++ = GENERIC_SENSOR_STAGE_COUNT;
+    *p++ = GENERIC_SENSOR_METRICS_BUCKETS;
+    *p++ = m_min_shift;
+    sys_put_le32(generic_cycles_per_sec(), p);
+    p += 4;
+
+    for (int i = 0; i < GENERIC_SENSOR_CNT_COUNT; i++) {
+        sys_put_le32(atomic_get(&m_counters[i]), p);
+        p += 4;
+    }
+
+    sys_put_le32(generic_sensor_ring_overflows(), p);
+    p += 4;
+    sys_put_le32(generic_sensor_ring_high_water(), p);
+    p += 4;
+
+    for (int i = 0; i < GENERIC_SENSOR_STAGE_COUNT; i++) {
+        const struct stage_hist *hist = &m_stages[i];
+
+        sys_put_le32(atomic_get(&hist->calls), p);
+        p += 4;
+        sys_put_le32(atomic_get(&hist->max), p);
+        p += 4;
+        for (int j = 0; j < GENERIC_SENSOR_METRICS_BUCKETS; j++) {
+            sys_put_le32(atomic_get(&hist->bucket[j]), p);
+            p += 4;
+        }
+    }
+
+    return p - buf;
+}
+
+void generic_sensor_metrics_reset(void)
+{
+    for (int i = 0; i < GENERIC_SENSOR_CNT_COUNT; i++) {
+        atomic_clear(&m_counters[i]);
+    }
+
+    for (int i = 0; i < GENERIC_SENSOR_STAGE_COUNT; i++) {
+        struct stage_hist *hist = &m_stages[i];
+
+        atomic_clear(&hist->calls);
+        atomic_clear(&hist->max);
+        for (int j = 0; j < GENERIC_SENSOR_METRICS_BUCKETS; j++) {
+            atomic_clear(&hist->bucket[j]);
+        }
+    }
+}
+
+/* Bucket 0 ends at the last power of two of cycles within 1 us */
+static int metrics_init(const struct device *dev)
+{
+    uint32_t per_us = generic_cycles_per_sec() / 1000000U;
+
+    ARG_UNUSED(dev);
+
+    m_min_shift = per_us ? 31 - __builtin_clz(per_us) : 0;
+
+    return 0;
+}
+
+SYS_INIT(metrics_init, APPLICATION, 0);
+
+#ifdef CONFIG_GENERIC_SENSOR_METRICS_SHELL
+#include <shell/shell.h>
+
+static const char *const stage_names[GENERIC_SENSOR_STAGE_COUNT] = {
+    [GENERIC_SENSOR_STAGE_ADC] = "adc",
+    [GENERIC_SENSOR_STAGE_OVERSAMPLE] = "oversample",
+    [GENERIC_SENSOR_STAGE_FILTER] = "filter",
+    [GENERIC_SENSOR_STAGE_TRIGGER] = "trigger",
+    [GENERIC_SENSOR_STAGE_ENCODE] = "encode",
+    [GENERIC_SENSOR_STAGE_NOTIFY] = "notify",
+};
+
+static const char *const counter_names[GENERIC_SENSOR_CNT_COUNT] = {
+    [GENERIC_SENSOR_CNT_SAMPLES] = "samples",
+    [GENERIC_SENSOR_CNT_FRAMES_SENT] = "frames sent",
+    [GENERIC_SENSOR_CNT_NOTIFY_ERRORS] = "notify errors",
+    [GENERIC_SENSOR_CNT_NOTIFY_ENOMEM] = "notify -ENOMEM",
+    [GENERIC_SENSOR_CNT_NOTIFY_BUSY] = "notify no credit",
+    [GENERIC_SENSOR_CNT_COPIES] = "frame copies",
+    [GENERIC_SENSOR_CNT_ALLOCS] = "buffer allocs",
+};
+
+static int cmd_metrics_show(const struct shell *shell, size_t argc,
+                            char **argv)
+{
+    for (int i = 0; i < GENERIC_SENSOR_CNT_COUNT; i++) {
+        shell_print(shell, "%-18s %u", counter_names[i],
+                    (uint32_t)atomic_get(&m_counters[i]));
+    }
+    shell_print(shell, "%-18s %u", "ring overflows",
+                generic_sensor_ring_overflows());
+    shell_print(shell, "%-18s %u", "ring high water",
+                generic_sensor_ring_high_water());
+
+    for (int i = 0; i < GENERIC_SENSOR_STAGE_COUNT; i++) {
+        const struct stage_hist *hist = &m_stages[i];
+        uint32_t calls = atomic_get(&hist->calls);
+
+        if (!calls) {
+            continue;
+        }
+
+        shell_print(shell, "%s: %u calls, max %u ns", stage_names[i], calls,
+                    generic_cycles_to_ns(atomic_get(&hist->max)));
+        for (int j = 0; j < GENERIC_SENSOR_METRICS_BUCKETS; j++) {
+            uint32_t n = atomic_get(&hist->bucket[j]);
+
+            if (!n) {
+                continue;
+            }
+
+            if (j < GENERIC_SENSOR_METRICS_BUCKETS - 1) {
+                shell_print(shell, "  < %9u ns: %u",
+                            generic_cycles_to_ns(BIT(m_min_shift + j)), n);
+            } else {
+                shell_print(shell, "  >= %8u ns: %u",
+                            generic_cycles_to_ns(BIT(m_min_shift + j - 1)),
+                            n);
+            }
+        }
+    }
+
+    return 0;
+}
+
+static int cmd_metrics_reset(const struct shell *shell, size_t argc,
+                             char **argv)
+{
+    generic_sensor_metrics_reset();
+    shell_print(shell, "Metrics reset");
+
+    return 0;
+}
+
+SHELL_STATIC_SUBCMD_SET_CREATE(sub_metrics,
+    SHELL_CMD(show, NULL, "Print counters and stage histograms",
+              cmd_metrics_show),
+    SHELL_CMD(reset, NULL, "Clear counters and histograms",
+              cmd_metrics_reset),
+    SHELL_SUBCMD_SET_END
+);
+
+SHELL_CMD_REGISTER(metrics, &sub_metrics, "Sensor pipeline metrics", NULL);
+#endif
@@ -0,0 +1,112 @@
+/*
+ * Pipeline metrics
+ *
+ * Cycle-counter histograms per pipeline stage and event counters, cheap
+ * enough to stay enabled on field units. Stages are timed with
+ *
+ *     uint32_t start = generic_sensor_metrics_start();
+ *     ...
+ *     generic_sensor_metrics_stage(GENERIC_SENSOR_STAGE_ADC, start);
+ *
+ * which compiles to nothing without CONFIG_GENERIC_SENSOR_METRICS.
+ */
+
+#ifndef GENERIC_SENSOR_METRICS__H
+#define GENERIC_SENSOR_METRICS__H
+
+#include <stddef.h>
+#include <stdint.h>
+#include <zephyr.h>
+
+#include "generic_cycles.h"
+
+enum generic_sensor_stage {
+    GENERIC_SENSOR_STAGE_ADC,           /* one conversion or scan */
+    GENERIC_SENSOR_STAGE_OVERSAMPLE,    /* whole oversampling loop */
+    GENERIC_SENSOR_STAGE_FILTER,        /* filter and convert one block */
+    GENERIC_SENSOR_STAGE_TRIGGER,       /* trigger condition check */
+    GENERIC_SENSOR_STAGE_ENCODE,        /* encode one frame */
+    GENERIC_SENSOR_STAGE_NOTIFY,        /* bt_gatt_notify_cb() */
+    GENERIC_SENSOR_STAGE_COUNT
+};
+
+enum generic_sensor_counter {
+    GENERIC_SENSOR_CNT_SAMPLES,         /* frames converted by the ADC */
+    GENERIC_SENSOR_CNT_FRAMES_SENT,     /* frames handed to the stack */
+    GENERIC_SENSOR_CNT_NOTIFY_ERRORS,   /* failed notifications, any error */
+    GENERIC_SENSOR_CNT_NOTIFY_ENOMEM,   /* of which out of buffers */
+    GENERIC_SENSOR_CNT_NOTIFY_BUSY,     /* skipped for lack of tx credits */
+    GENERIC_SENSOR_CNT_COPIES,          /* copies of frame data, any size */
+    GENERIC_SENSOR_CNT_ALLOCS,          /* buffers allocated for frame data */
+    GENERIC_SENSOR_CNT_COUNT
+};
+
+/*
+ * Stages are timed in generic_cycles_get() cycles. Bucket 0 holds
+ * durations below 2^min_shift cycles, bucket n those below twice the
+ * bound of bucket n - 1, and the last bucket everything longer.
+ * min_shift is picked at boot from the counter frequency so that bucket 0
+ * ends at about 1 us (6 at 64 MHz); it is part of the snapshot.
+ */
+#define GENERIC_SENSOR_METRICS_BUCKETS      16
+
+/*
+ * Snapshot layout (little endian), as read from the diagnostic
+ * characteristic:
+ *
+ *   uint8_t  version (3)
+ *   uint8_t  stage count, uint8_t bucket count, uint8_t min shift
+ *   uint32_t cycles per second
+ *   uint32_t counter[GENERIC_SENSOR_CNT_COUNT]
+ *   uint32_t ring overflows, uint32_t ring high water
+ *   per stage:
+ *     uint32_t calls, uint32_t max cycles, uint32_t bucket[buckets]
+ *
+ * Since version 2 the characteristic appends the link state of the
+ * reading connection, see generic_sensor_link.h. Version 3 added the copy
+ * and allocation counters; divided by the samples counter they give the
+ * copies and allocations per frame.
+ */
+#define GENERIC_SENSOR_METRICS_VERSION      3
+#define GENERIC_SENSOR_METRICS_STAGE_LEN                                \
+    (8 + 4 * GENERIC_SENSOR_METRICS_BUCKETS)
+#define GENERIC_SENSOR_METRICS_LEN                                      \
+    (8 + 4 * GENERIC_SENSOR_CNT_COUNT + 8 +                             \
+     GENERIC_SENSOR_STAGE_COUNT * GENERIC_SENSOR_METRICS_STAGE_LEN)
+
+#ifdef CONFIG_GENERIC_SENSOR_METRICS
+
+static inline uint32_t generic_sensor_metrics_start(void)
+{
+    return generic_cycles_get();
+}
+
+void generic_sensor_metrics_stage(enum generic_sensor_stage stage,
+                                  uint32_t start);
+void generic_sensor_metrics_count(enum generic_sensor_counter counter,
+                                  uint32_t n);
+
+/* Serialize a snapshot as described above, returns its length */
+size_t generic_sensor_metrics_snapshot(uint8_t *buf, size_t size);
+void generic_sensor_metrics_reset(void);
+
+#else
+
+static inline uint32_t generic_sensor_metrics_start(void)
+{
+    return 0;
+}
+
+static inline void generic_sensor_metrics_stage(
+    enum generic_sensor_stage stage, uint32_t start)
+{
+}
+
+static inline void generic_sensor_metrics_count(
+    enum generic_sensor_counter counter, uint32_t n)
+{
+}
+
+#endif
+
+#endif
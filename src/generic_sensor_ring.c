@@ -0,0 +1,114 @@
+/*
+ * Single-producer/single-consumer lock-free ring of sensor frames
+ *
+ * The producer only ever writes m_head and the consumer only ever writes
+ * m_tail, so neither side needs a lock. Both indices run freely and are
+ * masked on access, which keeps full and empty distinguishable without
+ * sacrificing a slot. The claim/publish and peek/release pairs let both
+ * sides work on the slot itself instead of copying frames in and out.
+ */
+
+#include "generic_sensor_ring.h"
+#include "generic_sensor_metrics.h"
+
+#include <zephyr.h>
+#include <sys/atomic.h>
+
+#define RING_SIZE   CONFIG_GENERIC_SENSOR_RING_SIZE
+#define RING_MASK   (RING_SIZE - 1)
+
+BUILD_ASSERT((RING_SIZE & RING_MASK) == 0,
+             "CONFIG_GENERIC_SENSOR_RING_SIZE must be a power of two");
+
+static struct generic_sensor_frame m_frames[RING_SIZE];
+static atomic_t m_head;
+static atomic_t m_tail;
+static atomic_t m_overflows;
+static atomic_t m_high_water;
+
+struct generic_sensor_frame *generic_sensor_ring_claim(void)
+{
+    atomic_val_t head = atomic_get(&m_head);
+
+    if (head - atomic_get(&m_tail) >= RING_SIZE) {
+        return NULL;
+    }
+
+    return &m_frames[head & RING_MASK];
+}
+
+void generic_sensor_ring_publish(void)
+{
+    atomic_val_t head = atomic_get(&m_head);
+    atomic_val_t used = head + 1 - atomic_get(&m_tail);
+
+    /* Publish the slot only after it has been written */
+    atomic_set(&m_head, head + 1);
+
+    if (used > atomic_get(&m_high_water)) {
+        atomic_set(&m_high_water, used);
+    }
+}
+
+bool generic_sensor_ring_put(const struct generic_sensor_frame *frame)
+{
+    struct generic_sensor_frame *slot = generic_sensor_ring_claim();
+
+    if (!slot) {
+        atomic_inc(&m_overflows);
+        return false;
+    }
+
+    *slot = *frame;
+    generic_sensor_metrics_count(GENERIC_SENSOR_CNT_COPIES, 1);
+    generic_sensor_ring_publish();
+
+    return true;
+}
+
+const struct generic_sensor_frame *generic_sensor_ring_peek(void)
+{
+    atomic_val_t tail = atomic_get(&m_tail);
+
+    if (tail == atomic_get(&m_head)) {
+        return NULL;
+    }
+
+    return &m_frames[tail & RING_MASK];
+}
+
+void generic_sensor_ring_release(void)
+{
+    /* Release the slot only after it has been read */
+    atomic_inc(&m_tail);
+}
+
+bool generic_sensor_ring_get(struct generic_sensor_frame *frame)
+{
+    const struct generic_sensor_frame *slot = generic_sensor_ring_peek();
+
+    if (!slot) {
+        return false;
+    }
+
+    *frame = *slot;
+    generic_sensor_metrics_count(GENERIC_SENSOR_CNT_COPIES, 1);
+    generic_sensor_ring_release();
+
+    return true;
+}
+
+uint32_t generic_sensor_ring_count(void)
+{
+    return atomic_get(&m_head) - atomic_get(&m_tail);
+}
+
+uint32_t generic_sensor_ring_overflows(void)
+{
+    return atomic_get(&m_overflows);
+}
+
+uint32_t generic_sensor_ring_high_water(void)
+{
+    return atomic_get(&m_high_water);
+}
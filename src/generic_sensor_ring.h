@@ -0,0 +1,45 @@
+/*
+ * Single-producer/single-consumer lock-free ring of sensor frames
+ */
+
+#include <stdbool.h>
+#include <stdint.h>
+
+#include "generic_sensor_adc.h"
+
+#ifndef GENERIC_SENSOR_RING__H
+#define GENERIC_SENSOR_RING__H
+
+struct generic_sensor_frame {
+    uint32_t timestamp_us;  /* uptime when the frame was converted */
+    uint16_t seq;           /* wraps, gaps mean frames were lost */
+    uint8_t report;         /* channels due, see report-dividers */
+    int16_t values[GENERIC_SENSOR_ADC_CHANNELS];
+};
+
+/* Producer side: returns false and counts an overflow if the ring is full */
+bool generic_sensor_ring_put(const struct generic_sensor_frame *frame);
+
+/*
+ * Producer side, in place: the free slot a frame can be built in, NULL if
+ * the ring is full. Nothing is queued until generic_sensor_ring_publish(),
+ * so the same slot is returned until then.
+ */
+struct generic_sensor_frame *generic_sensor_ring_claim(void);
+void generic_sensor_ring_publish(void);
+
+/* Consumer side: returns false if the ring is empty */
+bool generic_sensor_ring_get(struct generic_sensor_frame *frame);
+
+/*
+ * Consumer side, in place: the oldest frame, NULL if the ring is empty.
+ * It stays valid and in the ring until generic_sensor_ring_release().
+ */
+const struct generic_sensor_frame *generic_sensor_ring_peek(void);
+void generic_sensor_ring_release(void);
+
+uint32_t generic_sensor_ring_count(void);
+uint32_t generic_sensor_ring_overflows(void);
+uint32_t generic_sensor_ring_high_water(void);
+
+#endif
@@ -0,0 +1,173 @@
+/*
+ * Windowed per-channel statistics of the frame stream
+ *
+ * Frames are integer millivolts, so exact 64-bit sums of x and x^2 give
+ * the variance without the cancellation a floating point sum would
+ * suffer, at one multiply-add per channel and frame. Windows are capped
+ * at UINT16_MAX frames, which keeps n * sum(x^2) and sum(x)^2 below 2^62.
+ */
+
+#include "generic_sensor_stats.h"
+
+#include <errno.h>
+#include <string.h>
+#include <zephyr.h>
+#include <sys/byteorder.h>
+
+#define CHANNELS                        GENERIC_SENSOR_ADC_CHANNELS
+
+struct channel_stats {
+    int16_t min;
+    int16_t max;
+    int64_t sum;
+    uint64_t sum_sq;
+};
+
+static generic_sensor_stats_cb_t m_window_done;
+static atomic_t m_window_ms = ATOMIC_INIT(CONFIG_GENERIC_SENSOR_STATS_WINDOW_MS);
+
+/* Consumer thread only */
+static struct channel_stats m_ch[CHANNELS];
+static uint32_t m_window_us;
+static uint32_t m_first_us;
+static uint16_t m_count;
+static uint16_t m_window;
+
+/* Read from the Bluetooth thread */
+static struct k_spinlock m_lock;
+static uint8_t m_last[GENERIC_SENSOR_STATS_LEN];
+static bool m_have_last;
+
+static uint32_t isqrt64(uint64_t x)
+{
+    uint64_t bit = 1ULL << 62;
+    uint64_t root = 0;
+
+    while (bit > x) {
+        bit >>= 2;
+    }
+
+    while (bit) {
+        if (x >= root + bit) {
+            x -= root + bit;
+            root = (root >> 1) + bit;
+        } else {
+            root >>= 1;
+        }
+        bit >>= 2;
+    }
+
+    return root;
+}
+
+static void window_start(const struct generic_sensor_frame *frame)
+{
+    m_window_us = atomic_get(&m_window_ms) * 1000U;
+    m_first_us = frame->timestamp_us;
+    m_count = 0;
+
+    for (int i = 0; i < CHANNELS; i++) {
+        m_ch[i].min = INT16_MAX;
+        m_ch[i].max = INT16_MIN;
+        m_ch[i].sum = 0;
+        m_ch[i].sum_sq = 0;
+    }
+}
+
+static void window_finish(void)
+{
+    uint8_t summary[GENERIC_SENSOR_STATS_LEN];
+    uint8_t *p = &summary[GENERIC_SENSOR_STATS_HDR_LEN];
+    const int64_t n = m_count;
+    k_spinlock_key_t key;
+
+    sys_put_le16(m_window++, &summary[0]);
+    sys_put_le32(m_first_us, &summary[2]);
+    sys_put_le16(m_count, &summary[6]);
+
+    for (int i = 0; i < CHANNELS; i++) {
+        const struct channel_stats *ch = &m_ch[i];
+        /* Rounded half away from zero */
+        int64_t mean = (ch->sum < 0 ? ch->sum - n / 2 : ch->sum + n / 2) / n;
+        uint64_t var = ((uint64_t)n * ch->sum_sq -
+                        (uint64_t)(ch->sum * ch->sum)) / (uint64_t)(n * n);
+
+        sys_put_le16(ch->min, &p[0]);
+        sys_put_le16(ch->max, &p[2]);
+        sys_put_le16((int16_t)mean, &p[4]);
+        sys_put_le16(isqrt64(ch->sum_sq / n), &p[6]);
+        sys_put_le32(var, &p[8]);
+        p += GENERIC_SENSOR_STATS_CHANNEL_LEN;
+    }
+
+    key = k_spin_lock(&m_lock);
+    memcpy(m_last, summary, sizeof(m_last));
+    m_have_last = true;
+    k_spin_unlock(&m_lock, key);
+
+    if (m_window_done) {
+        m_window_done(summary, sizeof(summary));
+    }
+}
+
+void generic_sensor_stats_init(generic_sensor_stats_cb_t window_done)
+{
+    m_window_done = window_done;
+}
+
+int generic_sensor_stats_set_window(uint16_t window_ms)
+{
+    if (window_ms < GENERIC_SENSOR_STATS_MIN_WINDOW_MS ||
+        window_ms > GENERIC_SENSOR_STATS_MAX_WINDOW_MS) {
+        return -EINVAL;
+    }
+
+    atomic_set(&m_window_ms, window_ms);
+
+    return 0;
+}
+
+uint16_t generic_sensor_stats_window(void)
+{
+    return atomic_get(&m_window_ms);
+}
+
+void generic_sensor_stats_add(const struct generic_sensor_frame *frame)
+{
+    /* A window ends with the first frame beyond it, or when full */
+    if (m_count && (frame->timestamp_us - m_first_us >= m_window_us ||
+                    m_count == UINT16_MAX)) {
+        window_finish();
+        m_count = 0;
+    }
+
+    if (!m_count) {
+        window_start(frame);
+    }
+
+    for (int i = 0; i < CHANNELS; i++) {
+        struct channel_stats *ch = &m_ch[i];
+        int32_t x = frame->values[i];
+
+        if (x < ch->min) {
+            ch->min = x;
+        }
+        if (x > ch->max) {
+            ch->max = x;
+        }
+        ch->sum += x;
+        ch->sum_sq += (uint32_t)(x * x);
+    }
+    m_count++;
+}
+
+size_t generic_sensor_stats_last(uint8_t *buf, size_t size)
+{
+    k_spinlock_key_t key = k_spin_lock(&m_lock);
+    size_t len = m_have_last ? MIN(size, sizeof(m_last)) : 0;
+
+    memcpy(buf, m_last, len);
+    k_spin_unlock(&m_lock, key);
+
+    return len;
+}
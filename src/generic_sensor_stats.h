@@ -0,0 +1,75 @@
+/*
+ * Windowed per-channel statistics of the frame stream
+ *
+ * Every frame leaving the ring updates the running min, max, sum and sum
+ * of squares of each channel. Once a window of frame time has passed, the
+ * window is summarised into mean, RMS and variance and handed out as one
+ * small record, so a central that only needs the summary gets one
+ * notification per window instead of every frame.
+ *
+ * Summary layout (little endian):
+ *
+ *   uint16_t window        wraps, gaps mean summaries were lost
+ *   uint32_t timestamp_us  device time of the first frame in the window
+ *   uint16_t count         frames in the window
+ *   per channel:
+ *     int16_t  min         mV
+ *     int16_t  max         mV
+ *     int16_t  mean        mV, rounded
+ *     uint16_t rms         mV, rounded down
+ *     uint32_t variance    mV^2, of the population, rounded down
+ */
+
+#include <stddef.h>
+#include <stdint.h>
+
+#include "generic_sensor_ring.h"
+
+#ifndef GENERIC_SENSOR_STATS__H
+#define GENERIC_SENSOR_STATS__H
+
+#define GENERIC_SENSOR_STATS_HDR_LEN        8
+#define GENERIC_SENSOR_STATS_CHANNEL_LEN    12
+#define GENERIC_SENSOR_STATS_LEN                                        \
+    (GENERIC_SENSOR_STATS_HDR_LEN +                                     \
+     GENERIC_SENSOR_ADC_CHANNELS * GENERIC_SENSOR_STATS_CHANNEL_LEN)
+
+#define GENERIC_SENSOR_STATS_MIN_WINDOW_MS  10
+#define GENERIC_SENSOR_STATS_MAX_WINDOW_MS  60000
+
+/* Called on the consumer thread with every finished summary */
+typedef void (*generic_sensor_stats_cb_t)(const uint8_t *summary,
+                                          uint16_t len);
+
+#ifdef CONFIG_GENERIC_SENSOR_STATS
+
+void generic_sensor_stats_init(generic_sensor_stats_cb_t window_done);
+
+/*
+ * Takes effect with the next window. Returns -EINVAL outside
+ * GENERIC_SENSOR_STATS_MIN_WINDOW_MS..GENERIC_SENSOR_STATS_MAX_WINDOW_MS.
+ */
+int generic_sensor_stats_set_window(uint16_t window_ms);
+uint16_t generic_sensor_stats_window(void);
+
+/* Consumer side of the ring: account one frame of millivolts */
+void generic_sensor_stats_add(const struct generic_sensor_frame *frame);
+
+/* Copy of the last summary, 0 before the first window has closed */
+size_t generic_sensor_stats_last(uint8_t *buf, size_t size);
+
+#else
+
+static inline void generic_sensor_stats_init(
+    generic_sensor_stats_cb_t window_done)
+{
+}
+
+static inline void generic_sensor_stats_add(
+    const struct generic_sensor_frame *frame)
+{
+}
+
+#endif
+
+#endif
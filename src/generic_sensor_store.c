@@ -0,0 +1,399 @@
+/*
+ * Store-and-forward of sensor frames in a flash circular log
+ */
+
+#include "generic_sensor_store.h"
+#include "generic_sensor_encode.h"
+#include "generic_sensor_time.h"
+
+#include <errno.h>
+#include <string.h>
+#include <zephyr.h>
+#include <sys/byteorder.h>
+#include <storage/flash_map.h>
+#include <fs/fcb.h>
+#include <logging/log.h>
+
+LOG_MODULE_REGISTER(generic_sensor_store, CONFIG_GENERIC_SENSOR_LOG_LEVEL);
+
+/* The settings subsystem keeps the storage partition to itself */
+#if FLASH_AREA_LABEL_EXISTS(sensor_log)
+#define STORE_FLASH_AREA        FLASH_AREA_ID(sensor_log)
+#else
+BUILD_ASSERT(!IS_ENABLED(CONFIG_SETTINGS),
+             "Add a sensor_log flash partition for the flash log");
+#define STORE_FLASH_AREA        FLASH_AREA_ID(storage)
+#endif
+#define STORE_MAX_SECTORS       16
+#define STORE_MAGIC             0x53475346  /* "FSGS" */
+/* Changes with the record layout, fcb_init() rejects older logs */
+#define STORE_VERSION           1
+#define STORE_ENCODING          GENERIC_SENSOR_ENC_DELTA
+#define ATT_NOTIFY_OVERHEAD     3
+
+BUILD_ASSERT(GENERIC_SENSOR_STORE_RECORD_LEN > GENERIC_SENSOR_STORE_HDR_LEN,
+             "Store record too small for its header");
+
+static struct flash_sector m_sectors[STORE_MAX_SECTORS];
+static struct fcb m_fcb;
+static bool m_ready;
+static uint32_t m_next_id;
+
+/*
+ * Guards the FCB and the record being filled, which the transmit thread,
+ * the download work and the GATT handlers all reach. Zephyr mutexes nest,
+ * so locked paths may call generic_sensor_store_flush().
+ */
+static K_MUTEX_DEFINE(m_lock);
+
+/* Record being filled */
+static uint8_t m_record[GENERIC_SENSOR_STORE_RECORD_LEN];
+static struct generic_sensor_encoder m_enc;
+static uint8_t m_count;
+static uint16_t m_next_seq;
+static uint32_t m_skip;
+
+/* The one download in progress */
+static struct {
+    struct generic_sensor_conn *gc;
+    const struct bt_gatt_attr *attr;
+    struct fcb_entry loc;
+    uint32_t from_id;
+    uint8_t buf[GENERIC_SENSOR_STORE_RECORD_LEN];
+    uint16_t len;       /* record in buf still to be sent, 0 if none */
+    bool done;
+} m_dl;
+
+static void download_work_handler(struct k_work *work);
+static K_WORK_DEFINE(m_download_work, download_work_handler);
+
+static int read_id(struct fcb_entry *loc, uint32_t *id)
+{
+    uint8_t buf[sizeof(*id)];
+    int err;
+
+    err = flash_area_read(m_fcb.fap, FCB_ENTRY_FA_DATA_OFF((*loc)), buf,
+                          sizeof(buf));
+    *id = sys_get_le32(buf);
+
+    return err;
+}
+
+/* Sectors of an older layout cannot be reused without an erase */
+static int erase_log(void)
+{
+    const struct flash_area *fa;
+    int err;
+
+    err = flash_area_open(STORE_FLASH_AREA, &fa);
+    if (err) {
+        return err;
+    }
+
+    err = flash_area_erase(fa, 0, fa->fa_size);
+    flash_area_close(fa);
+
+    return err;
+}
+
+int generic_sensor_store_init(void)
+{
+    struct fcb_entry loc = { 0 };
+    uint32_t cnt = STORE_MAX_SECTORS;
+    uint32_t id;
+    int err;
+
+    err = flash_area_get_sectors(STORE_FLASH_AREA, &cnt, m_sectors);
+    if (err) {
+        LOG_ERR("No storage partition sectors (err %d)", err);
+        return err;
+    }
+
+    m_fcb.f_magic = STORE_MAGIC;
+    m_fcb.f_version = STORE_VERSION;
+    m_fcb.f_sectors = m_sectors;
+    m_fcb.f_sector_cnt = cnt;
+
+    err = fcb_init(STORE_FLASH_AREA, &m_fcb);
+    if (err) {
+        LOG_WRN("Flash log unreadable (err %d), erasing", err);
+        err = erase_log();
+        if (!err) {
+            err = fcb_init(STORE_FLASH_AREA, &m_fcb);
+        }
+    }
+    if (err) {
+        LOG_ERR("Flash log init failed (err %d)", err);
+        return err;
+    }
+
+    /* Ids only grow, continue after the newest record that survived */
+    while (!fcb_getnext(&m_fcb, &loc)) {
+        if (!read_id(&loc, &id) && id >= m_next_id) {
+            m_next_id = id + 1;
+        }
+    }
+
+    m_ready = true;
+    LOG_INF("Flash log: %u sectors, next record %u", cnt, m_next_id);
+
+    return 0;
+}
+
+/* Must be called with m_lock held */
+static int append_record(const uint8_t *data, uint16_t len)
+{
+    struct fcb_entry loc;
+    int err;
+
+    err = fcb_append(&m_fcb, len, &loc);
+    if (err == -ENOSPC) {
+        /* Full: reclaim the oldest sector */
+        err = fcb_rotate(&m_fcb);
+        if (!err) {
+            err = fcb_append(&m_fcb, len, &loc);
+        }
+    }
+    if (err) {
+        return err;
+    }
+
+    err = flash_area_write(m_fcb.fap, FCB_ENTRY_FA_DATA_OFF(loc), data, len);
+    if (err) {
+        return err;
+    }
+
+    return fcb_append_finish(&m_fcb, &loc);
+}
+
+int generic_sensor_store_flush(void)
+{
+    size_t len;
+    int err;
+
+    if (!m_ready) {
+        return 0;
+    }
+
+    k_mutex_lock(&m_lock, K_FOREVER);
+    if (!m_count) {
+        k_mutex_unlock(&m_lock);
+        return 0;
+    }
+
+    len = generic_sensor_encoder_finish(&m_enc);
+    m_record[14] = m_count;
+    m_count = 0;
+    sys_put_le32(m_next_id, &m_record[0]);
+    err = append_record(m_record, GENERIC_SENSOR_STORE_HDR_LEN + len);
+    if (!err) {
+        m_next_id++;
+    }
+    k_mutex_unlock(&m_lock);
+
+    if (err) {
+        LOG_WRN("Record dropped (err %d)", err);
+    }
+
+    return err;
+}
+
+static void record_open(const struct generic_sensor_frame *frame)
+{
+    uint64_t time_us = generic_sensor_time_extend(frame->timestamp_us);
+    uint8_t flags = 0;
+    int64_t offset_us;
+    int32_t skew_ppb;
+
+    /* Uptime means nothing after a reboot, a synced time still does */
+    if (generic_sensor_time_offset(time_us, &offset_us, &skew_ppb)) {
+        time_us += offset_us;
+        flags |= GENERIC_SENSOR_STORE_SYNCED;
+    }
+
+    sys_put_le64(time_us, &m_record[4]);
+    sys_put_le16(frame->seq, &m_record[12]);
+    m_record[15] = STORE_ENCODING | flags;
+    generic_sensor_encoder_init(&m_enc, STORE_ENCODING,
+                                GENERIC_SENSOR_ADC_CHANNELS,
+                                &m_record[GENERIC_SENSOR_STORE_HDR_LEN],
+                                sizeof(m_record) -
+                                GENERIC_SENSOR_STORE_HDR_LEN);
+}
+
+void generic_sensor_store_add(const struct generic_sensor_frame *frame)
+{
+    if (!m_ready) {
+        return;
+    }
+
+    if (m_skip) {
+        m_skip--;
+        return;
+    }
+    m_skip = CONFIG_GENERIC_SENSOR_STORE_DECIMATION - 1;
+
+    k_mutex_lock(&m_lock, K_FOREVER);
+
+    /* A record only describes evenly spaced frames, close it on a gap */
+    if (m_count && frame->seq != m_next_seq) {
+        generic_sensor_store_flush();
+    }
+
+    if (!m_count) {
+        record_open(frame);
+    }
+
+    if (generic_sensor_encoder_add(&m_enc, frame->values)) {
+        generic_sensor_store_flush();
+        record_open(frame);
+        generic_sensor_encoder_add(&m_enc, frame->values);
+    }
+
+    m_count++;
+    m_next_seq = frame->seq + CONFIG_GENERIC_SENSOR_STORE_DECIMATION;
+
+    if (m_count == UINT8_MAX ||
+        m_enc.size - m_enc.len <
+        generic_sensor_encode_max_frame_len(STORE_ENCODING,
+                                            GENERIC_SENSOR_ADC_CHANNELS)) {
+        generic_sensor_store_flush();
+    }
+
+    k_mutex_unlock(&m_lock);
+}
+
+void generic_sensor_store_span(uint32_t *oldest, uint32_t *next)
+{
+    struct fcb_entry loc = { 0 };
+
+    *oldest = *next = m_next_id;
+
+    if (!m_ready) {
+        return;
+    }
+
+    k_mutex_lock(&m_lock, K_FOREVER);
+    if (!fcb_getnext(&m_fcb, &loc)) {
+        read_id(&loc, oldest);
+    }
+    *next = m_next_id;
+    k_mutex_unlock(&m_lock);
+}
+
+/* Must be called with m_lock held, loads the next record due into m_dl */
+static bool download_load_next(void)
+{
+    uint32_t id;
+
+    while (!fcb_getnext(&m_fcb, &m_dl.loc)) {
+        if (read_id(&m_dl.loc, &id) || id < m_dl.from_id) {
+            continue;
+        }
+
+        m_dl.len = MIN(m_dl.loc.fe_data_len, sizeof(m_dl.buf));
+        if (flash_area_read(m_fcb.fap, FCB_ENTRY_FA_DATA_OFF(m_dl.loc),
+                            m_dl.buf, m_dl.len)) {
+            continue;
+        }
+
+        return true;
+    }
+
+    /* End of the backlog: tell the central where to resume next time */
+    sys_put_le32(m_next_id, m_dl.buf);
+    m_dl.len = sizeof(m_next_id);
+    m_dl.done = true;
+
+    return false;
+}
+
+static void download_tx_ready(struct generic_sensor_conn *gc)
+{
+    k_work_submit(&m_download_work);
+}
+
+static void download_work_handler(struct k_work *work)
+{
+    struct generic_sensor_conn *gc = m_dl.gc;
+    int err;
+
+    if (!gc) {
+        return;
+    }
+
+    /* Send until the connection runs out of credits, resumed by tx_ready */
+    while (m_dl.gc) {
+        if (!m_dl.len) {
+            k_mutex_lock(&m_lock, K_FOREVER);
+            download_load_next();
+            k_mutex_unlock(&m_lock);
+        }
+
+        err = generic_sensor_conn_notify(gc, m_dl.attr, m_dl.buf, m_dl.len);
+        if (err == -EBUSY || err == -ENOMEM) {
+            return;
+        }
+        if (err) {
+            LOG_WRN("Download aborted (err %d)", err);
+            break;
+        }
+
+        m_dl.len = 0;
+        if (m_dl.done) {
+            LOG_INF("Download complete");
+            break;
+        }
+    }
+
+    gc->tx_ready = NULL;
+    m_dl.gc = NULL;
+}
+
+int generic_sensor_store_download(struct generic_sensor_conn *gc,
+                                  const struct bt_gatt_attr *attr,
+                                  uint32_t from_id)
+{
+    struct k_work_sync sync;
+
+    if (!m_ready) {
+        return -ENODEV;
+    }
+
+    if (m_dl.gc && m_dl.gc != gc) {
+        return -EBUSY;
+    }
+
+    if (gc->mtu - ATT_NOTIFY_OVERHEAD < GENERIC_SENSOR_STORE_RECORD_LEN) {
+        return -EMSGSIZE;
+    }
+
+    /* Include the frames collected since the last record was written */
+    generic_sensor_store_flush();
+
+    k_work_cancel_sync(&m_download_work, &sync);
+    memset(&m_dl.loc, 0, sizeof(m_dl.loc));
+    m_dl.attr = attr;
+    m_dl.from_id = from_id;
+    m_dl.len = 0;
+    m_dl.done = false;
+    m_dl.gc = gc;
+    gc->tx_ready = download_tx_ready;
+
+    LOG_INF("Download from record %u", from_id);
+    k_work_submit(&m_download_work);
+
+    return 0;
+}
+
+void generic_sensor_store_cancel(struct generic_sensor_conn *gc)
+{
+    struct k_work_sync sync;
+
+    if (gc && m_dl.gc == gc) {
+        gc->tx_ready = NULL;
+        m_dl.gc = NULL;
+        /* The connection goes away next, the work must not touch it */
+        k_work_cancel_sync(&m_download_work, &sync);
+    }
+}
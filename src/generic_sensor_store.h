@@ -0,0 +1,62 @@
+/*
+ * Store-and-forward of sensor frames in a flash circular log
+ *
+ * While no central is subscribed, frames are packed into records and
+ * appended to an FCB in the storage partition. The oldest sector is
+ * reclaimed when the log is full. A central downloads the backlog through
+ * the store characteristic, resuming from the id of the next record it
+ * still needs.
+ *
+ * Record layout (little endian), identical in flash and on the air:
+ *
+ *   uint32_t id            increments with every record, survives reboots
+ *   uint64_t time_us       time of the first frame
+ *   uint16_t first_seq     sequence number of the first frame
+ *   uint8_t  count         frames in the record
+ *   uint8_t  encoding      wire encoding of the frames, ORed with
+ *                          GENERIC_SENSOR_STORE_SYNCED if time_us is on
+ *                          the clock of the central that last synced the
+ *                          device, else it is device uptime of that boot
+ *   frames[count]
+ *
+ * A download ends with a notification holding only the uint32_t id of the
+ * next record to be written.
+ */
+
+#ifndef GENERIC_SENSOR_STORE__H
+#define GENERIC_SENSOR_STORE__H
+
+#include <stdint.h>
+
+#include "generic_sensor_conn.h"
+#include "generic_sensor_ring.h"
+
+#define GENERIC_SENSOR_STORE_HDR_LEN    16
+#define GENERIC_SENSOR_STORE_SYNCED     0x80
+#define GENERIC_SENSOR_STORE_RECORD_LEN CONFIG_GENERIC_SENSOR_STORE_RECORD_SIZE
+
+int generic_sensor_store_init(void);
+
+/* Keep a frame no central received, every Nth one per Kconfig */
+void generic_sensor_store_add(const struct generic_sensor_frame *frame);
+
+/* Write the partially filled record out, e.g. before a download */
+int generic_sensor_store_flush(void);
+
+/* Ids of the oldest record still stored and of the next one to be written */
+void generic_sensor_store_span(uint32_t *oldest, uint32_t *next);
+
+/*
+ * Stream every stored record with an id from from_id on to gc, as fast as
+ * its tx credits allow. Only one download runs at a time; -EBUSY if
+ * another central is downloading, -EMSGSIZE if the MTU cannot carry a
+ * record.
+ */
+int generic_sensor_store_download(struct generic_sensor_conn *gc,
+                                  const struct bt_gatt_attr *attr,
+                                  uint32_t from_id);
+
+/* Stop the download of gc, if any, e.g. on disconnect */
+void generic_sensor_store_cancel(struct generic_sensor_conn *gc);
+
+#endif
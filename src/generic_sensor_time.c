@@ -0,0 +1,90 @@
+/*
+ * Device time base for sample timestamps
+ *
+ * Skew is estimated from two syncs at least TIME_SKEW_MIN_BASE_US apart,
+ * so that the latency of the sync write, a few connection intervals at
+ * most, stays small against the baseline. Estimates beyond
+ * TIME_SKEW_MAX_PPB are taken for a delayed write and dropped; accepted
+ * ones are averaged with the previous estimate.
+ */
+
+#include "generic_sensor_time.h"
+
+#include <zephyr.h>
+
+#define TIME_SKEW_MIN_BASE_US   (60 * USEC_PER_SEC)
+#define TIME_SKEW_MAX_PPB       200000
+#define PPB                     1000000000LL
+
+static struct k_spinlock m_lock;
+/* Last sync, the offset holds at m_sync_us */
+static uint64_t m_sync_us;
+static int64_t m_offset_us;
+/* Older sync the skew is measured against */
+static uint64_t m_base_us;
+static int64_t m_base_offset_us;
+static int32_t m_skew_ppb;
+static bool m_have_skew;
+static bool m_synced;
+
+uint64_t generic_sensor_time_now_us(void)
+{
+    return k_ticks_to_us_floor64(k_uptime_ticks());
+}
+
+uint64_t generic_sensor_time_extend(uint32_t timestamp_us)
+{
+    uint64_t now = generic_sensor_time_now_us();
+
+    /* Unsigned difference is right across a wrap of the low word */
+    return now - (uint32_t)((uint32_t)now - timestamp_us);
+}
+
+void generic_sensor_time_sync(uint64_t ref_us)
+{
+    uint64_t now = generic_sensor_time_now_us();
+    int64_t offset = (int64_t)(ref_us - now);
+    k_spinlock_key_t key = k_spin_lock(&m_lock);
+
+    if (!m_synced) {
+        m_base_us = now;
+        m_base_offset_us = offset;
+    } else if (now - m_base_us >= TIME_SKEW_MIN_BASE_US) {
+        /* Central clock gained drift on the device over base */
+        int64_t base = (int64_t)(now - m_base_us);
+        int64_t drift = offset - m_base_offset_us;
+        int64_t limit = base / (PPB / TIME_SKEW_MAX_PPB);
+
+        /* Checked before scaling, which then cannot overflow */
+        if (drift >= -limit && drift <= limit) {
+            int32_t skew = (int32_t)(drift * PPB / base);
+
+            m_skew_ppb = m_have_skew ? (m_skew_ppb + skew) / 2 : skew;
+            m_have_skew = true;
+        }
+        m_base_us = now;
+        m_base_offset_us = offset;
+    }
+
+    m_sync_us = now;
+    m_offset_us = offset;
+    m_synced = true;
+    k_spin_unlock(&m_lock, key);
+}
+
+bool generic_sensor_time_offset(uint64_t device_us, int64_t *offset_us,
+                                int32_t *skew_ppb)
+{
+    k_spinlock_key_t key = k_spin_lock(&m_lock);
+    bool synced = m_synced;
+
+    *skew_ppb = m_skew_ppb;
+    *offset_us = m_offset_us +
+                 (int64_t)(device_us - m_sync_us) * m_skew_ppb / PPB;
+    if (!synced) {
+        *offset_us = 0;
+    }
+    k_spin_unlock(&m_lock, key);
+
+    return synced;
+}
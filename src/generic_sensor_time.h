@@ -0,0 +1,40 @@
+/*
+ * Device time base for sample timestamps
+ *
+ * Frames are stamped with the low 32 bits of the device clock in
+ * microseconds, read from the kernel tick counter (the RTC on nRF52) when
+ * the ADC finishes a scan. They wrap after about 71 minutes. A central that
+ * wrote its own clock to the time sync characteristic gets the offset to
+ * add, so it can place every frame on its own time line. From the second
+ * sync a minute or more after the first on, the offset is also corrected
+ * for the rate difference of the two clocks, so it stays valid between
+ * syncs instead of drifting by the crystal tolerance (up to 40 ppm, about
+ * 2.4 ms a minute).
+ */
+
+#include <stdbool.h>
+#include <stdint.h>
+
+#ifndef GENERIC_SENSOR_TIME__H
+#define GENERIC_SENSOR_TIME__H
+
+/* Device clock: microseconds since boot */
+uint64_t generic_sensor_time_now_us(void);
+
+/* Full device time of a 32-bit frame timestamp from the last 71 minutes */
+uint64_t generic_sensor_time_extend(uint32_t timestamp_us);
+
+/* Align to a central clock that read ref_us at this very moment */
+void generic_sensor_time_sync(uint64_t ref_us);
+
+/*
+ * Central clock minus device clock at device time device_us, false and 0
+ * until the first sync. skew_ppb is how much faster the central clock
+ * runs, in parts per billion, 0 until it has been measured; the offset
+ * at another device time t is offset_us + (t - device_us) * skew_ppb / 1e9.
+ * Lost on reboot.
+ */
+bool generic_sensor_time_offset(uint64_t device_us, int64_t *offset_us,
+                                int32_t *skew_ppb);
+
+#endif
@@ -0,0 +1,129 @@
+/*
+ * ES Trigger Setting condition engine across all sensor channels
+ *
+ * Every channel has its own trigger setting. Channels with an inactive
+ * trigger do not take part, the remaining ones are combined with the ES
+ * Configuration trigger logic.
+ */
+
+#include "generic_sensor_trigger.h"
+
+#include <stdlib.h>
+
+bool generic_sensor_trigger_is_valid(uint8_t condition)
+{
+    return condition <= NOT_EQUAL_TO_REF_VALUE;
+}
+
+void generic_sensor_trigger_set(struct generic_sensor_trigger *trigger,
+                                const struct generic_sensor_trigger *cfg)
+{
+    *trigger = *cfg;
+    trigger->active = false;
+}
+
+static bool value_changed(int16_t val, int16_t last, uint16_t deadband)
+{
+    return abs((int32_t)val - last) > deadband;
+}
+
+static bool time_elapsed(const struct generic_sensor_triggers *triggers,
+                         uint32_t ms, uint32_t now_ms)
+{
+    return !triggers->sent || now_ms - triggers->last_sent_ms >= ms;
+}
+
+static bool check_reference(struct generic_sensor_trigger *trigger,
+                            int16_t val)
+{
+    int32_t ref = trigger->ref_val;
+    int32_t hyst = trigger->hysteresis;
+    bool hit;
+
+    /* Once active, an ordering condition holds until val is hyst past ref */
+    switch (trigger->condition) {
+    case LESS_THAN_REF_VALUE:
+        hit = val < ref || (trigger->active && val < ref + hyst);
+        break;
+    case LESS_OR_EQUAL_TO_REF_VALUE:
+        hit = val <= ref || (trigger->active && val <= ref + hyst);
+        break;
+    case GREATER_THAN_REF_VALUE:
+        hit = val > ref || (trigger->active && val > ref - hyst);
+        break;
+    case GREATER_OR_EQUAL_TO_REF_VALUE:
+        hit = val >= ref || (trigger->active && val >= ref - hyst);
+        break;
+    case EQUAL_TO_REF_VALUE:
+        return abs(val - ref) <= hyst;
+    case NOT_EQUAL_TO_REF_VALUE:
+        return abs(val - ref) > hyst;
+    default:
+        return false;
+    }
+
+    trigger->active = hit;
+    return hit;
+}
+
+/* Returns -1 if the channel does not take part, else 0 or 1 */
+static int check_channel(struct generic_sensor_triggers *triggers, int ch,
+                         int16_t val, uint32_t now_ms)
+{
+    struct generic_sensor_trigger *trigger = &triggers->channel[ch];
+    int16_t last = triggers->last_sent[ch];
+
+    switch (trigger->condition) {
+    case TRIGGER_INACTIVE:
+        return -1;
+    case FIXED_TIME_INTERVAL:
+        return time_elapsed(triggers, trigger->milliseconds, now_ms);
+    case NO_LESS_THAN_SPECIFIED_TIME:
+        /* A change, but rate limited to one per period */
+        return time_elapsed(triggers, trigger->milliseconds, now_ms) &&
+               (!triggers->sent ||
+                value_changed(val, last, trigger->deadband));
+    case VALUE_CHANGED:
+        return !triggers->sent || value_changed(val, last, trigger->deadband);
+    default:
+        return check_reference(trigger, val);
+    }
+}
+
+bool generic_sensor_trigger_check(struct generic_sensor_triggers *triggers,
+                                  const int16_t values[], uint32_t now_ms)
+{
+    bool any = false;
+    bool all = true;
+    bool participating = false;
+
+    /* Evaluate every channel, reference conditions keep latched state */
+    for (int ch = 0; ch < GENERIC_SENSOR_ADC_CHANNELS; ch++) {
+        int res = check_channel(triggers, ch, values[ch], now_ms);
+
+        if (res < 0) {
+            continue;
+        }
+
+        participating = true;
+        any = any || res;
+        all = all && res;
+    }
+
+    if (!participating) {
+        return false;
+    }
+
+    return triggers->logic == TRIGGER_LOGIC_OR ? any : all;
+}
+
+void generic_sensor_trigger_sent(struct generic_sensor_triggers *triggers,
+                                 const int16_t values[], uint32_t now_ms)
+{
+    for (int ch = 0; ch < GENERIC_SENSOR_ADC_CHANNELS; ch++) {
+        triggers->last_sent[ch] = values[ch];
+    }
+
+    triggers->last_sent_ms = now_ms;
+    triggers->sent = true;
+}
@@ -0,0 +1,72 @@
+/*
+ * ES Trigger Setting condition engine across all sensor channels
+ */
+
+#include <stdbool.h>
+#include <stdint.h>
+
+#include "generic_sensor_adc.h"
+
+#ifndef GENERIC_SENSOR_TRIGGER__H
+#define GENERIC_SENSOR_TRIGGER__H
+
+/* Trigger Setting conditions */
+#define TRIGGER_INACTIVE                0x00
+#define FIXED_TIME_INTERVAL             0x01
+#define NO_LESS_THAN_SPECIFIED_TIME     0x02
+#define VALUE_CHANGED                   0x03
+#define LESS_THAN_REF_VALUE             0x04
+#define LESS_OR_EQUAL_TO_REF_VALUE      0x05
+#define GREATER_THAN_REF_VALUE          0x06
+#define GREATER_OR_EQUAL_TO_REF_VALUE   0x07
+#define EQUAL_TO_REF_VALUE              0x08
+#define NOT_EQUAL_TO_REF_VALUE          0x09
+
+/* ES Configuration descriptor: how channel conditions combine */
+#define TRIGGER_LOGIC_AND               0x00
+#define TRIGGER_LOGIC_OR                0x01
+
+struct generic_sensor_trigger {
+    uint8_t condition;
+    union {
+        uint32_t milliseconds;
+        int16_t ref_val;
+    };
+    /*
+     * VALUE_CHANGED and NO_LESS_THAN_SPECIFIED_TIME: the value has to move
+     * by more than this from the last notified value.
+     */
+    uint16_t deadband;
+    /*
+     * Ordering conditions release only once the value is back past
+     * ref_val by this much. Equality conditions treat it as a tolerance.
+     */
+    uint16_t hysteresis;
+
+    /* Latched state of an ordering condition with hysteresis */
+    bool active;
+};
+
+struct generic_sensor_triggers {
+    struct generic_sensor_trigger channel[GENERIC_SENSOR_ADC_CHANNELS];
+    uint8_t logic;
+
+    /* What was last notified, and when */
+    int16_t last_sent[GENERIC_SENSOR_ADC_CHANNELS];
+    uint32_t last_sent_ms;
+    bool sent;
+};
+
+bool generic_sensor_trigger_is_valid(uint8_t condition);
+void generic_sensor_trigger_set(struct generic_sensor_trigger *trigger,
+                                const struct generic_sensor_trigger *cfg);
+
+/* Whether a frame with these values should be notified at now_ms */
+bool generic_sensor_trigger_check(struct generic_sensor_triggers *triggers,
+                                  const int16_t values[], uint32_t now_ms);
+
+/* Record a notification, time and value conditions are relative to it */
+void generic_sensor_trigger_sent(struct generic_sensor_triggers *triggers,
+                                 const int16_t values[], uint32_t now_ms);
+
+#endif
@@ -0,0 +1,129 @@
+/*
+ * Wakeup and CPU activity counters
+ */
+
+#include "generic_wakeup.h"
+#include "generic_cycles.h"
+
+#include <errno.h>
+#include <zephyr.h>
+#include <logging/log.h>
+
+LOG_MODULE_REGISTER(generic_wakeup, CONFIG_GENERIC_SENSOR_LOG_LEVEL);
+
+#ifdef CONFIG_GENERIC_WAKEUP_STATS
+
+/*
+ * The idle thread reports itself with interrupts locked right before it
+ * sleeps, so the first interrupt after that is the wakeup. Both hooks run
+ * with interrupts locked and need no further protection on one CPU.
+ *
+ * Only the active stretches, from a wakeup to the next idle entry, are
+ * timed in CPU cycles: the DWT counter stops while the core sleeps. The
+ * window itself is measured in kernel ticks.
+ */
+static bool m_idle;
+static bool m_active_timed;
+static uint32_t m_active_start;
+static uint32_t m_wakeups;
+static uint64_t m_active_cycles;
+
+void sys_trace_idle_user(void)
+{
+    if (m_active_timed) {
+        m_active_cycles += generic_cycles_get() - m_active_start;
+    }
+    m_idle = true;
+}
+
+void sys_trace_isr_enter_user(int nested_interrupts)
+{
+    if (m_idle) {
+        m_idle = false;
+        m_wakeups++;
+        m_active_start = generic_cycles_get();
+        m_active_timed = true;
+    }
+}
+
+int generic_wakeup_stats_get(struct generic_wakeup_stats *stats)
+{
+    static int64_t last_ticks;
+    static uint32_t last_wakeups;
+    static uint64_t last_active_cycles;
+    int64_t now;
+    uint64_t elapsed_us, active, window_cycles;
+    uint32_t wakeups;
+    unsigned int key;
+
+    key = irq_lock();
+    now = k_uptime_ticks();
+    wakeups = m_wakeups - last_wakeups;
+    active = m_active_cycles - last_active_cycles;
+    last_wakeups = m_wakeups;
+    last_active_cycles = m_active_cycles;
+    irq_unlock(key);
+
+    elapsed_us = k_ticks_to_us_floor64(now - last_ticks);
+    last_ticks = now;
+    if (!elapsed_us) {
+        return -EAGAIN;
+    }
+
+    window_cycles = elapsed_us * generic_cycles_per_sec() / 1000000U;
+    if (active > window_cycles) {
+        active = window_cycles;
+    }
+
+    stats->wakeups = (uint32_t)(wakeups * 1000000ULL / elapsed_us);
+    stats->active_cycles = (uint32_t)(active * 1000000U / elapsed_us);
+    stats->active_permille = window_cycles ?
+                             (uint16_t)(active * 1000 / window_cycles) : 0;
+
+    return 0;
+}
+
+#if CONFIG_GENERIC_WAKEUP_STATS_INTERVAL > 0
+static void wakeup_report(struct k_work *work)
+{
+    struct generic_wakeup_stats stats;
+
+    if (!generic_wakeup_stats_get(&stats)) {
+        LOG_INF("Wakeups: %u/s, active %u cycles/s (%u.%u%%)",
+                stats.wakeups, stats.active_cycles,
+                stats.active_permille / 10, stats.active_permille % 10);
+    }
+
+    k_work_reschedule(k_work_delayable_from_work(work),
+                      K_SECONDS(CONFIG_GENERIC_WAKEUP_STATS_INTERVAL));
+}
+
+static K_WORK_DELAYABLE_DEFINE(wakeup_report_work, wakeup_report);
+
+static int wakeup_report_init(const struct device *dev)
+{
+    struct generic_wakeup_stats stats;
+
+    ARG_UNUSED(dev);
+
+    /* Start the first window now */
+    (void)generic_wakeup_stats_get(&stats);
+    k_work_schedule(&wakeup_report_work,
+                    K_SECONDS(CONFIG_GENERIC_WAKEUP_STATS_INTERVAL));
+
+    return 0;
+}
+
+SYS_INIT(wakeup_report_init, APPLICATION, CONFIG_APPLICATION_INIT_PRIORITY);
+#endif
+
+#else
+
+int generic_wakeup_stats_get(struct generic_wakeup_stats *stats)
+{
+    ARG_UNUSED(stats);
+
+    return -ENOTSUP;
+}
+
+#endif
@@ -0,0 +1,35 @@
+/*
+ * Wakeup and CPU activity counters
+ *
+ * Counts how often the CPU leaves idle and how many cycles it spends
+ * outside the idle thread, to verify the idle current budget. Counting
+ * hooks into the kernel's user tracing and is compiled in with
+ * CONFIG_GENERIC_WAKEUP_STATS only.
+ */
+
+#ifndef GENERIC_WAKEUP__H
+#define GENERIC_WAKEUP__H
+
+#include <stdint.h>
+
+struct generic_wakeup_stats {
+    /* Idle exits per second */
+    uint32_t wakeups;
+    /*
+     * CPU cycles per second spent outside the idle thread, counted with
+     * generic_cycles_get(): DWT cycles with CONFIG_TIMING_FUNCTIONS,
+     * system timer cycles (RTC ticks on nRF52) without
+     */
+    uint32_t active_cycles;
+    /* Active share of the window in 1/1000 */
+    uint16_t active_permille;
+};
+
+/*
+ * Rates since the previous call, so that calling this once per reporting
+ * interval is all the bookkeeping needed. Returns -ENOTSUP when the
+ * counters are not built in.
+ */
+int generic_wakeup_stats_get(struct generic_wakeup_stats *stats);
+
+#endif
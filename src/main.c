@@ -11,50 +11,104 @@
 #include <stddef.h>
 #include <string.h>
 #include <errno.h>
-#include <sys/printk.h>
 #include <sys/byteorder.h>
 #include <zephyr.h>
+#include <logging/log.h>
+
+LOG_MODULE_REGISTER(generic_sensor, CONFIG_GENERIC_SENSOR_LOG_LEVEL);
 
 // Analog-to-Digital header
 #include "generic_sensor_adc.h"
 
+// ADC calibration manager
+#include "generic_sensor_cal.h"
+
 // LED blink header
 #include "generic_led.h"
 
+// Battery level from the supply voltage
+#include "generic_battery.h"
+
+// Notification batching header
+#include "generic_sensor_batch.h"
+
+// Sampling to transmit frame ring header
+#include "generic_sensor_ring.h"
+
+// Sample stream wire encodings
+#include "generic_sensor_encode.h"
+
+// Decimation filter stage
+#include "generic_sensor_filter.h"
+
+// ES trigger condition engine
+#include "generic_sensor_trigger.h"
+
+// Per-connection stream state
+#include "generic_sensor_conn.h"
+
+// Pipeline metrics
+#include "generic_sensor_metrics.h"
+
+// Benchmark build
+#include "generic_sensor_bench.h"
+
+// Flash store-and-forward
+#include "generic_sensor_store.h"
+
+// L2CAP channel streaming
+#include "generic_sensor_l2cap.h"
+
+// Link parameter tuning
+#include "generic_sensor_link.h"
+
+// Sample time base
+#include "generic_sensor_time.h"
+
+// Windowed statistics
+#include "generic_sensor_stats.h"
+
+// Spectral features
+#include "generic_sensor_fft.h"
+
 // Bluetooth libraries
 #include <bluetooth/bluetooth.h>
 #include <bluetooth/hci.h>
 #include <bluetooth/conn.h>
 #include <bluetooth/uuid.h>
 #include <bluetooth/gatt.h>
-#include <bluetooth/services/bas.h>
 
 #define SENSOR_1_NAME				"Sensor 1"
 
 /* Sensor Internal Update Interval [miliseconds] */
 #define SENSOR_1_UPDATE_IVAL            100
+/* One block of samples is spread evenly over the update interval */
+#define SENSOR_1_SAMPLE_IVAL_US         (SENSOR_1_UPDATE_IVAL * 1000 / \
+                                         GENERIC_SENSOR_ADC_BLOCK_FRAMES)
+/* Sensor ADC instance sampled for sensor 1 */
+#define SENSOR_1_ADC                    GENERIC_SENSOR_ADC_DEVICE
+
+/* Default decimation, can be changed by the central at runtime */
+#ifdef CONFIG_GENERIC_SENSOR_BATCH
+/* Stream every sample */
+#define SENSOR_1_FILTER_TYPE            GENERIC_SENSOR_FILTER_NONE
+#define SENSOR_1_FILTER_RATIO           1
+#else
+/* One mean per update interval */
+#define SENSOR_1_FILTER_TYPE            GENERIC_SENSOR_FILTER_MOVING_AVERAGE
+#define SENSOR_1_FILTER_RATIO           GENERIC_SENSOR_ADC_BLOCK_FRAMES
+#endif
 // #define SENSOR_2_UPDATE_IVAL         100
 // #define SENSOR_3_UPDATE_IVAL         60
 
+/* Transmit thread, kept below the ADC sampling thread */
+#define SENSOR_TX_THREAD_STACK_SIZE     1024
+#define SENSOR_TX_THREAD_PRIORITY       K_PRIO_PREEMPT(5)
+
 /* error definitions */
 #define ERR_WRITE_REJECT                0x80
 #define ERR_COND_NOT_SUPP               0x81
 
-/* Trigger Setting conditions */
-#define TRIGGER_INACTIVE                0x00
-#define FIXED_TIME_INTERVAL             0x01
-#define NO_LESS_THAN_SPECIFIED_TIME     0x02
-#define VALUE_CHANGED                   0x03
-#define LESS_THAN_REF_VALUE             0x04
-#define LESS_OR_EQUAL_TO_REF_VALUE      0x05
-#define GREATER_THAN_REF_VALUE          0x06
-#define GREATER_OR_EQUAL_TO_REF_VALUE   0x07
-#define EQUAL_TO_REF_VALUE              0x08
-#define NOT_EQUAL_TO_REF_VALUE          0x09
-
-
-int blink_red_led_flag = 1;
-int blink_blue_led_flag = 0;
 
 // static uint64_t time, last_time;
 
@@ -74,16 +128,56 @@ static struct bt_uuid_128 BT_UUID_GENERIC_SENSOR_CHARACTERISTIC = BT_UUID_INIT_1
 static struct bt_uuid_128 BT_UUID_GS_MEASUREMENT = BT_UUID_INIT_128(
     0x9e, 0x2e, 0x6a, 0x13, 0x6e, 0x1d, 0x86, 0xab,
     0xba, 0x43, 0x02, 0x00, 0xcf, 0x14, 0xea, 0xa7);
+
+static struct bt_uuid_128 BT_UUID_GS_ENCODING = BT_UUID_INIT_128(
+    0x9e, 0x2e, 0x6a, 0x13, 0x6e, 0x1d, 0x86, 0xab,
+    0xba, 0x43, 0x03, 0x00, 0xcf, 0x14, 0xea, 0xa7);
+
+static struct bt_uuid_128 BT_UUID_GS_FILTER = BT_UUID_INIT_128(
+    0x9e, 0x2e, 0x6a, 0x13, 0x6e, 0x1d, 0x86, 0xab,
+    0xba, 0x43, 0x04, 0x00, 0xcf, 0x14, 0xea, 0xa7);
+
+static struct bt_uuid_128 BT_UUID_GS_DIAGNOSTICS = BT_UUID_INIT_128(
+    0x9e, 0x2e, 0x6a, 0x13, 0x6e, 0x1d, 0x86, 0xab,
+    0xba, 0x43, 0x05, 0x00, 0xcf, 0x14, 0xea, 0xa7);
+
+static struct bt_uuid_128 BT_UUID_GS_STORE = BT_UUID_INIT_128(
+    0x9e, 0x2e, 0x6a, 0x13, 0x6e, 0x1d, 0x86, 0xab,
+    0xba, 0x43, 0x06, 0x00, 0xcf, 0x14, 0xea, 0xa7);
+
+static struct bt_uuid_128 BT_UUID_GS_L2CAP_PSM = BT_UUID_INIT_128(
+    0x9e, 0x2e, 0x6a, 0x13, 0x6e, 0x1d, 0x86, 0xab,
+    0xba, 0x43, 0x07, 0x00, 0xcf, 0x14, 0xea, 0xa7);
+
+static struct bt_uuid_128 BT_UUID_GS_TIME_SYNC = BT_UUID_INIT_128(
+    0x9e, 0x2e, 0x6a, 0x13, 0x6e, 0x1d, 0x86, 0xab,
+    0xba, 0x43, 0x08, 0x00, 0xcf, 0x14, 0xea, 0xa7);
+
+static struct bt_uuid_128 BT_UUID_GS_STATS = BT_UUID_INIT_128(
+    0x9e, 0x2e, 0x6a, 0x13, 0x6e, 0x1d, 0x86, 0xab,
+    0xba, 0x43, 0x09, 0x00, 0xcf, 0x14, 0xea, 0xa7);
+
+static struct bt_uuid_128 BT_UUID_GS_STATS_WINDOW = BT_UUID_INIT_128(
+    0x9e, 0x2e, 0x6a, 0x13, 0x6e, 0x1d, 0x86, 0xab,
+    0xba, 0x43, 0x0a, 0x00, 0xcf, 0x14, 0xea, 0xa7);
+
+static struct bt_uuid_128 BT_UUID_GS_SPECTRUM = BT_UUID_INIT_128(
+    0x9e, 0x2e, 0x6a, 0x13, 0x6e, 0x1d, 0x86, 0xab,
+    0xba, 0x43, 0x0b, 0x00, 0xcf, 0x14, 0xea, 0xa7);
+
+static struct bt_uuid_128 BT_UUID_GS_SPECTRUM_BANDS = BT_UUID_INIT_128(
+    0x9e, 0x2e, 0x6a, 0x13, 0x6e, 0x1d, 0x86, 0xab,
+    0xba, 0x43, 0x0c, 0x00, 0xcf, 0x14, 0xea, 0xa7);
     
 static ssize_t read_u16(struct bt_conn *conn, const struct bt_gatt_attr *attr,
                         void *buf, uint16_t len, uint16_t offset)
 {
-    printk("read_u16\n");
+    LOG_DBG("read_u16");
 
     const uint16_t *u16 = attr->user_data;
     uint16_t value = sys_cpu_to_le16(*u16);
 
-    printk("Size of data: %d\n", sizeof(value));
+    LOG_DBG("Size of data: %u", (uint32_t)sizeof(value));
 
     return bt_gatt_attr_read(conn, attr, buf, len, offset, &value,
                             sizeof(value));
@@ -100,30 +194,40 @@ struct measurement {
 };
 
 struct generic_sensor {
-    int16_t sensor_values[3];
-    
+    int16_t sensor_values[GENERIC_SENSOR_ADC_CHANNELS];
+
     /* Valid Range */
     int16_t lower_limit;
     int16_t upper_limit;
 
-    /* ES trigger setting - Value Notification condition */
-    uint8_t condition;
-    union {
-        uint32_t milliseconds;
-        int16_t ref_val; /* Reference temperature */
-    };
+    /*
+     * ES trigger settings per channel and their ES configuration. Every
+     * new connection starts from these, then keeps its own copy.
+     */
+    struct generic_sensor_triggers triggers;
 
     struct measurement meas;
 };
 
-int16_t values[3];
+static K_SEM_DEFINE(sensor_tx_sem, 0, 1);
 
 static bool notify_enabled;
+static bool stats_enabled;
+static bool spectrum_enabled;
+static void sensor_block_ready(const struct device *dev, const int16_t *block,
+                size_t frames, uint32_t timestamp_us);
+/* Ping-pong buffer of raw frames the ADC streams into */
+static int16_t sensor_1_blocks[2 * GENERIC_SENSOR_ADC_BLOCK_FRAMES *
+                               GENERIC_SENSOR_ADC_CHANNELS];
 static struct generic_sensor sensor_1 = {
-        .sensor_values = {0, 0, 0},
         .lower_limit = -10000,
         .upper_limit = 10000,
-        .condition = FIXED_TIME_INTERVAL,
+        .triggers = {
+            .channel = {
+                [0] = { .condition = FIXED_TIME_INTERVAL },
+            },
+            .logic = TRIGGER_LOGIC_OR,
+        },
         .meas.sampling_func = 0x00,
         .meas.meas_period = 0x01,
         .meas.update_interval = SENSOR_1_UPDATE_IVAL,
@@ -131,14 +235,247 @@ static struct generic_sensor sensor_1 = {
         .meas.meas_uncertainty = 0x04,
 };
 
+#ifdef CONFIG_GENERIC_SENSOR_BATCH
+/*
+ * One batch per encoding, shared by the connections using it that the
+ * batched frames were triggered for, one bit per bt_conn_index()
+ */
+static struct generic_sensor_batch batches[GENERIC_SENSOR_ENC_COUNT];
+static uint32_t batch_recipients[GENERIC_SENSOR_ENC_COUNT];
+
+BUILD_ASSERT(CONFIG_BT_MAX_CONN <= 32, "Batch recipients are a 32-bit mask");
+
+struct batch_mtu {
+    uint16_t mtu[GENERIC_SENSOR_ENC_COUNT];
+    uint8_t users[GENERIC_SENSOR_ENC_COUNT];
+};
+
+static void collect_batch_mtu(struct generic_sensor_conn *gc, void *user_data)
+{
+    struct batch_mtu *bm = user_data;
+
+    if (!gc->subscribed) {
+        return;
+    }
+
+    if (!bm->users[gc->encoding] || gc->mtu < bm->mtu[gc->encoding]) {
+        bm->mtu[gc->encoding] = gc->mtu;
+    }
+    bm->users[gc->encoding]++;
+}
+
+/* Size each batch for the smallest MTU among the connections it feeds */
+static void update_batches(void)
+{
+    struct batch_mtu bm = { 0 };
+
+    generic_sensor_conn_foreach(collect_batch_mtu, &bm);
+
+    for (int i = 0; i < GENERIC_SENSOR_ENC_COUNT; i++) {
+        if (bm.users[i]) {
+            generic_sensor_batch_set_mtu(&batches[i], bm.mtu[i]);
+        } else {
+            generic_sensor_batch_reset(&batches[i]);
+        }
+    }
+}
+
+struct batch_gate {
+    const struct generic_sensor_frame *frame;
+    uint32_t now_ms;
+    uint32_t triggered[GENERIC_SENSOR_ENC_COUNT];
+};
+
+static void gate_batch_conn(struct generic_sensor_conn *gc, void *user_data)
+{
+    struct batch_gate *gate = user_data;
+    uint32_t start;
+
+    if (!gc->subscribed) {
+        return;
+    }
+
+    start = generic_sensor_metrics_start();
+    if (generic_sensor_trigger_check(&gc->triggers, gate->frame->values,
+                    gate->now_ms)) {
+        gate->triggered[gc->encoding] |= BIT(bt_conn_index(gc->conn));
+        /* The value and time conditions count from the batched frame */
+        generic_sensor_trigger_sent(&gc->triggers, gate->frame->values,
+                        gate->now_ms);
+    }
+    generic_sensor_metrics_stage(GENERIC_SENSOR_STAGE_TRIGGER, start);
+}
+
+/*
+ * Each connection's own trigger conditions decide which frames it gets.
+ * Connections that agree share one batch, so a frame is still encoded
+ * once per format; a batch is sent before its set of recipients changes.
+ */
+static void batch_frame(const struct generic_sensor_frame *frame)
+{
+    struct batch_gate gate = {
+        .frame = frame,
+        .now_ms = k_uptime_get_32(),
+    };
+
+    generic_sensor_conn_foreach(gate_batch_conn, &gate);
+
+    for (int i = 0; i < GENERIC_SENSOR_ENC_COUNT; i++) {
+        if (!gate.triggered[i]) {
+            continue;
+        }
+
+        if (gate.triggered[i] != batch_recipients[i]) {
+            generic_sensor_batch_flush(&batches[i]);
+            batch_recipients[i] = gate.triggered[i];
+        }
+        generic_sensor_batch_add(&batches[i], frame);
+    }
+}
+#endif
+
+/* Settings of the asking central, the defaults outside a connection */
+static struct generic_sensor_triggers *conn_triggers(struct bt_conn *conn)
+{
+    struct generic_sensor_conn *gc = generic_sensor_conn_get(conn);
+
+    return gc ? &gc->triggers : &sensor_1.triggers;
+}
+
+/* How often this connection is sent a packet while it streams */
+static uint32_t packet_interval_us(const struct generic_sensor_conn *gc)
+{
+    struct generic_sensor_filter_cfg cfg;
+    uint32_t frame_us;
+
+    generic_sensor_filter_get_config(&cfg);
+    frame_us = cfg.ratio * SENSOR_1_SAMPLE_IVAL_US;
+
+#ifdef CONFIG_GENERIC_SENSOR_BATCH
+    /* An L2CAP channel wants throughput, there every frame counts */
+    if (!generic_sensor_l2cap_is_open(gc->conn)) {
+        uint16_t payload = MIN(gc->mtu - 3, GENERIC_SENSOR_BATCH_MAX_LEN) -
+                           GENERIC_SENSOR_BATCH_HDR_LEN;
+        uint32_t frames = MAX(payload / generic_sensor_batch_max_frame_len(
+                                  gc->encoding), 1);
+
+        return MIN(frames * frame_us,
+                   CONFIG_GENERIC_SENSOR_BATCH_LATENCY_MS * 1000);
+    }
+#endif
+
+    return frame_us;
+}
+
+/* Tighten the link while the connection takes frames, relax it after */
+static void update_link(struct generic_sensor_conn *gc, void *user_data)
+{
+    if (gc->subscribed || generic_sensor_l2cap_is_open(gc->conn)) {
+        generic_sensor_link_stream(gc->conn, packet_interval_us(gc));
+    } else {
+        generic_sensor_link_relax(gc->conn);
+    }
+}
+
+/* Someone takes frames live, through notifications or an L2CAP channel */
+static bool sensor_streaming(void)
+{
+    return notify_enabled || generic_sensor_l2cap_active();
+}
+
+static void count_conn(struct generic_sensor_conn *gc, void *user_data)
+{
+    (*(int *)user_data)++;
+}
+
+/* Status LEDs: advertising, connected or streaming */
+static void update_led(void)
+{
+    int connections = 0;
+
+    generic_sensor_conn_foreach(count_conn, &connections);
+    if (sensor_streaming()) {
+        generic_led_set_state(GENERIC_LED_STREAMING);
+    } else if (connections) {
+        generic_led_set_state(GENERIC_LED_CONNECTED);
+    } else {
+        generic_led_set_state(GENERIC_LED_ADVERTISING);
+    }
+}
+
+/* Someone takes frames or only features computed from them */
+static bool sensor_sampling(void)
+{
+    return sensor_streaming() || stats_enabled || spectrum_enabled;
+}
+
+static void streaming_changed(void)
+{
+    update_led();
+
+#ifdef CONFIG_GENERIC_SENSOR_STORE
+    /* Sampling never stops, frames go to flash while nobody listens */
+    if (sensor_streaming()) {
+        generic_sensor_store_flush();
+        return;
+    }
+#else
+    /* Sample in the background only while someone listens */
+    if (sensor_sampling()) {
+        generic_sensor_adc_start(SENSOR_1_ADC, SENSOR_1_SAMPLE_IVAL_US,
+                                 sensor_1_blocks,
+                                 GENERIC_SENSOR_ADC_BLOCK_FRAMES,
+                                 sensor_block_ready);
+        return;
+    }
+
+    generic_sensor_adc_stop(SENSOR_1_ADC);
+#endif
+
+    LOG_INF("Frame ring: %u overflows, high water %u",
+            generic_sensor_ring_overflows(),
+            generic_sensor_ring_high_water());
+}
+
 static void gs_ccc_cfg_changed(const struct bt_gatt_attr *attr,
                 uint16_t value)
 {
-    printk("gs_ccc_cfg_changed\n");
-    printk("Value received: %d\n", value);
+    LOG_DBG("gs_ccc_cfg_changed");
+    LOG_DBG("Value received: %d", value);
     notify_enabled = value == BT_GATT_CCC_NOTIFY;
+    streaming_changed();
+}
+
+static void l2cap_channel_changed(struct bt_conn *conn, bool open)
+{
+    struct generic_sensor_conn *gc = generic_sensor_conn_get(conn);
+
+    if (gc) {
+        update_link(gc, NULL);
+    }
+    streaming_changed();
 }
 
+/* Per-connection half of the CCC, gs_ccc_cfg_changed() sees the union */
+static ssize_t gs_ccc_cfg_write(struct bt_conn *conn,
+                const struct bt_gatt_attr *attr, uint16_t value)
+{
+    struct generic_sensor_conn *gc = generic_sensor_conn_get(conn);
+
+    if (gc) {
+        gc->subscribed = value == BT_GATT_CCC_NOTIFY;
+#ifdef CONFIG_GENERIC_SENSOR_BATCH
+        update_batches();
+#endif
+        update_link(gc, NULL);
+    }
+
+    return sizeof(value);
+}
+
+static struct _bt_gatt_ccc gs_ccc = BT_GATT_CCC_INITIALIZER(
+    gs_ccc_cfg_changed, gs_ccc_cfg_write, NULL);
+
 struct read_es_measurement_rp {
     uint16_t flags; /* Reserved for Future Use */
     uint8_t sampling_function;
@@ -152,7 +489,7 @@ static ssize_t read_gs_measurement(struct bt_conn *conn,
                 const struct bt_gatt_attr *attr, void *buf,
                 uint16_t len, uint16_t offset)
 {
-    printk("read_gs_measurement\n");
+    LOG_DBG("read_gs_measurement");
     const struct measurement *value = attr->user_data;
     struct read_es_measurement_rp rsp;
 
@@ -167,11 +504,123 @@ static ssize_t read_gs_measurement(struct bt_conn *conn,
                 sizeof(rsp));
 }
 
+static ssize_t read_gs_encoding(struct bt_conn *conn,
+                const struct bt_gatt_attr *attr, void *buf,
+                uint16_t len, uint16_t offset)
+{
+    LOG_DBG("read_gs_encoding");
+    struct generic_sensor_conn *gc = generic_sensor_conn_get(conn);
+    uint8_t encoding = gc ? gc->encoding : GENERIC_SENSOR_ENC_RAW16;
+
+    return bt_gatt_attr_read(conn, attr, buf, len, offset,
+                &encoding, sizeof(encoding));
+}
+
+static ssize_t write_gs_encoding(struct bt_conn *conn,
+                const struct bt_gatt_attr *attr, const void *buf,
+                uint16_t len, uint16_t offset, uint8_t flags)
+{
+    LOG_DBG("write_gs_encoding");
+    struct generic_sensor_conn *gc = generic_sensor_conn_get(conn);
+    uint8_t encoding;
+
+    if (!gc) {
+        return BT_GATT_ERR(ERR_WRITE_REJECT);
+    }
+
+    if (offset) {
+        return BT_GATT_ERR(BT_ATT_ERR_INVALID_OFFSET);
+    }
+
+    if (len != sizeof(encoding)) {
+        return BT_GATT_ERR(BT_ATT_ERR_INVALID_ATTRIBUTE_LEN);
+    }
+
+    encoding = *(const uint8_t *)buf;
+    if (!generic_sensor_encoding_is_valid(encoding)) {
+        return BT_GATT_ERR(ERR_WRITE_REJECT);
+    }
+
+    gc->encoding = encoding;
+#ifdef CONFIG_GENERIC_SENSOR_BATCH
+    update_batches();
+#endif
+    update_link(gc, NULL);
+
+    return len;
+}
+
+struct gs_filter_setting {
+    uint8_t type;
+    uint16_t ratio;
+} __packed;
+
+/* Decimation changes what a reading is and how often one is produced */
+static int apply_filter(struct generic_sensor *sensor,
+                const struct generic_sensor_filter_cfg *cfg)
+{
+    int err = generic_sensor_filter_configure(cfg);
+
+    if (err) {
+        return err;
+    }
+
+    sensor->meas.sampling_func = generic_sensor_filter_sampling_func(cfg->type);
+    sensor->meas.update_interval = cfg->ratio * SENSOR_1_SAMPLE_IVAL_US / 1000;
+
+    return 0;
+}
+
+static ssize_t read_gs_filter(struct bt_conn *conn,
+                const struct bt_gatt_attr *attr, void *buf,
+                uint16_t len, uint16_t offset)
+{
+    LOG_DBG("read_gs_filter");
+    struct generic_sensor_filter_cfg cfg;
+    struct gs_filter_setting rp;
+
+    generic_sensor_filter_get_config(&cfg);
+    rp.type = cfg.type;
+    rp.ratio = sys_cpu_to_le16(cfg.ratio);
+
+    return bt_gatt_attr_read(conn, attr, buf, len, offset, &rp, sizeof(rp));
+}
+
+static ssize_t write_gs_filter(struct bt_conn *conn,
+                const struct bt_gatt_attr *attr, const void *buf,
+                uint16_t len, uint16_t offset, uint8_t flags)
+{
+    LOG_DBG("write_gs_filter");
+    struct generic_sensor *sensor = attr->user_data;
+    const struct gs_filter_setting *req = buf;
+    struct generic_sensor_filter_cfg cfg;
+
+    if (offset) {
+        return BT_GATT_ERR(BT_ATT_ERR_INVALID_OFFSET);
+    }
+
+    if (len != sizeof(*req)) {
+        return BT_GATT_ERR(BT_ATT_ERR_INVALID_ATTRIBUTE_LEN);
+    }
+
+    cfg.type = req->type;
+    cfg.ratio = sys_le16_to_cpu(req->ratio);
+
+    if (apply_filter(sensor, &cfg)) {
+        return BT_GATT_ERR(ERR_WRITE_REJECT);
+    }
+
+    /* The frame rate changed, and with it the interval each link needs */
+    generic_sensor_conn_foreach(update_link, NULL);
+
+    return len;
+}
+
 static ssize_t read_value_valid_range(struct bt_conn *conn,
                     const struct bt_gatt_attr *attr, void *buf,
                     uint16_t len, uint16_t offset)
 {
-    printk("read_value_valid_range\n");
+    LOG_DBG("read_value_valid_range");
     const struct generic_sensor *sensor = attr->user_data;
     uint16_t tmp[] = {sys_cpu_to_le16(sensor->lower_limit),
             sys_cpu_to_le16(sensor->upper_limit)};
@@ -190,113 +639,621 @@ struct es_trigger_setting_reference {
     int16_t ref_val;
 } __packed;
 
+/*
+ * Trigger settings accept an optional trailing uint16 beyond the ESS
+ * operand: the deadband for value change conditions and the hysteresis
+ * for reference value conditions. It is only read back when non-zero.
+ */
+struct es_trigger_setting_milliseconds_ext {
+    struct es_trigger_setting_milliseconds base;
+    uint16_t deadband;
+} __packed;
+
+struct es_trigger_setting_deadband {
+    uint8_t condition;
+    uint16_t deadband;
+} __packed;
+
+struct es_trigger_setting_reference_ext {
+    struct es_trigger_setting_reference base;
+    uint16_t hysteresis;
+} __packed;
+
 static ssize_t read_value_trigger_setting(struct bt_conn *conn,
                     const struct bt_gatt_attr *attr,
                     void *buf, uint16_t len,
                     uint16_t offset)
 {
-    printk("read_value_trigger_setting\n");
-    const struct generic_sensor *sensor = attr->user_data;
+    LOG_DBG("read_value_trigger_setting");
+    const struct generic_sensor_trigger *trigger =
+        &conn_triggers(conn)->channel[POINTER_TO_UINT(attr->user_data)];
 
-    switch (sensor->condition) {
+    switch (trigger->condition) {
     /* Operand N/A */
     case TRIGGER_INACTIVE:
-        __fallthrough;
-    case VALUE_CHANGED:
         return bt_gatt_attr_read(conn, attr, buf, len, offset,
-                    &sensor->condition,
-                    sizeof(sensor->condition));
+                    &trigger->condition,
+                    sizeof(trigger->condition));
+    case VALUE_CHANGED: {
+            struct es_trigger_setting_deadband rp;
+
+            rp.condition = trigger->condition;
+            rp.deadband = sys_cpu_to_le16(trigger->deadband);
+
+            return bt_gatt_attr_read(conn, attr, buf, len, offset, &rp,
+                        trigger->deadband ? sizeof(rp) :
+                        sizeof(rp.condition));
+        }
     /* Milli seconds */
     case FIXED_TIME_INTERVAL:
         __fallthrough;
     case NO_LESS_THAN_SPECIFIED_TIME: {
-            struct es_trigger_setting_milliseconds rp;
+            struct es_trigger_setting_milliseconds_ext rp;
 
-            rp.condition = sensor->condition;
-            sys_put_le24(sensor->milliseconds, rp.millisec);
+            rp.base.condition = trigger->condition;
+            sys_put_le24(trigger->milliseconds, rp.base.millisec);
+            rp.deadband = sys_cpu_to_le16(trigger->deadband);
 
-            return bt_gatt_attr_read(conn, attr, buf, len, offset,
-                        &rp, sizeof(rp));
+            return bt_gatt_attr_read(conn, attr, buf, len, offset, &rp,
+                        trigger->deadband ? sizeof(rp) :
+                        sizeof(rp.base));
         }
     /* Reference temperature */
     default: {
-            struct es_trigger_setting_reference rp;
+            struct es_trigger_setting_reference_ext rp;
 
-            rp.condition = sensor->condition;
-            rp.ref_val = sys_cpu_to_le16(sensor->ref_val);
+            rp.base.condition = trigger->condition;
+            rp.base.ref_val = sys_cpu_to_le16(trigger->ref_val);
+            rp.hysteresis = sys_cpu_to_le16(trigger->hysteresis);
 
-            return bt_gatt_attr_read(conn, attr, buf, len, offset,
-                        &rp, sizeof(rp));
+            return bt_gatt_attr_read(conn, attr, buf, len, offset, &rp,
+                        trigger->hysteresis ? sizeof(rp) :
+                        sizeof(rp.base));
         }
     }
 }
 
-static bool check_condition(uint8_t condition, int16_t *old_val, int16_t *new_val,
-                int16_t ref_val)
+static ssize_t write_value_trigger_setting(struct bt_conn *conn,
+                    const struct bt_gatt_attr *attr,
+                    const void *buf, uint16_t len,
+                    uint16_t offset, uint8_t flags)
 {
-    printk("check_condition\n");
-    switch (condition) {
+    LOG_DBG("write_value_trigger_setting");
+    struct generic_sensor_trigger *trigger =
+        &conn_triggers(conn)->channel[POINTER_TO_UINT(attr->user_data)];
+    struct generic_sensor_trigger cfg = { 0 };
+    const uint8_t *data = buf;
+
+    if (offset) {
+        return BT_GATT_ERR(BT_ATT_ERR_INVALID_OFFSET);
+    }
+
+    if (!len) {
+        return BT_GATT_ERR(BT_ATT_ERR_INVALID_ATTRIBUTE_LEN);
+    }
+
+    cfg.condition = data[0];
+    if (!generic_sensor_trigger_is_valid(cfg.condition)) {
+        return BT_GATT_ERR(ERR_COND_NOT_SUPP);
+    }
+
+    switch (cfg.condition) {
     case TRIGGER_INACTIVE:
-        return false;
+        if (len != sizeof(cfg.condition)) {
+            return BT_GATT_ERR(BT_ATT_ERR_INVALID_ATTRIBUTE_LEN);
+        }
+        break;
+    case VALUE_CHANGED:
+        if (len == sizeof(struct es_trigger_setting_deadband)) {
+            cfg.deadband = sys_get_le16(&data[1]);
+        } else if (len != sizeof(cfg.condition)) {
+            return BT_GATT_ERR(BT_ATT_ERR_INVALID_ATTRIBUTE_LEN);
+        }
+        break;
     case FIXED_TIME_INTERVAL:
-                return true;
+        __fallthrough;
     case NO_LESS_THAN_SPECIFIED_TIME:
-        /* TODO: Check time requirements */
-        return false;
-    case VALUE_CHANGED:
-        return new_val[0] != old_val[0];
-    case LESS_THAN_REF_VALUE:
-        return new_val[0] < ref_val;
-    case LESS_OR_EQUAL_TO_REF_VALUE:
-        return new_val[0] <= ref_val;
-    case GREATER_THAN_REF_VALUE:
-        return new_val[0] > ref_val;
-    case GREATER_OR_EQUAL_TO_REF_VALUE:
-        return new_val[0] >= ref_val;
-    case EQUAL_TO_REF_VALUE:
-        return new_val[0] == ref_val;
-    case NOT_EQUAL_TO_REF_VALUE:
-        return new_val[0] != ref_val;
+        if (len == sizeof(struct es_trigger_setting_milliseconds_ext)) {
+            cfg.deadband = sys_get_le16(&data[4]);
+        } else if (len != sizeof(struct es_trigger_setting_milliseconds)) {
+            return BT_GATT_ERR(BT_ATT_ERR_INVALID_ATTRIBUTE_LEN);
+        }
+        cfg.milliseconds = sys_get_le24(&data[1]);
+        break;
     default:
-        return false;
+        if (len == sizeof(struct es_trigger_setting_reference_ext)) {
+            cfg.hysteresis = sys_get_le16(&data[3]);
+        } else if (len != sizeof(struct es_trigger_setting_reference)) {
+            return BT_GATT_ERR(BT_ATT_ERR_INVALID_ATTRIBUTE_LEN);
+        }
+        cfg.ref_val = (int16_t)sys_get_le16(&data[1]);
+        break;
+    }
+
+    generic_sensor_trigger_set(trigger, &cfg);
+
+    return len;
+}
+
+static ssize_t read_es_configuration(struct bt_conn *conn,
+                    const struct bt_gatt_attr *attr,
+                    void *buf, uint16_t len,
+                    uint16_t offset)
+{
+    LOG_DBG("read_es_configuration");
+    const struct generic_sensor_triggers *triggers = conn_triggers(conn);
+
+    return bt_gatt_attr_read(conn, attr, buf, len, offset,
+                &triggers->logic, sizeof(triggers->logic));
+}
+
+static ssize_t write_es_configuration(struct bt_conn *conn,
+                    const struct bt_gatt_attr *attr,
+                    const void *buf, uint16_t len,
+                    uint16_t offset, uint8_t flags)
+{
+    LOG_DBG("write_es_configuration");
+    struct generic_sensor_triggers *triggers = conn_triggers(conn);
+    uint8_t logic;
+
+    if (offset) {
+        return BT_GATT_ERR(BT_ATT_ERR_INVALID_OFFSET);
+    }
+
+    if (len != sizeof(logic)) {
+        return BT_GATT_ERR(BT_ATT_ERR_INVALID_ATTRIBUTE_LEN);
+    }
+
+    logic = *(const uint8_t *)buf;
+    if (logic != TRIGGER_LOGIC_AND && logic != TRIGGER_LOGIC_OR) {
+        return BT_GATT_ERR(ERR_WRITE_REJECT);
     }
+
+    triggers->logic = logic;
+
+    return len;
 }
 
-static void update_sensor_values(struct bt_conn *conn,
-                const struct bt_gatt_attr *chrc,
-                struct generic_sensor *sensor)
+BUILD_ASSERT(GENERIC_SENSOR_ADC_CHANNELS <= GENERIC_SENSOR_ENC_MAX_CHANNELS,
+             "Channel table larger than the encoder supports");
+
+/*
+ * Single frame notification (little endian):
+ *   uint16_t seq           wraps, gaps mean frames were lost
+ *   uint32_t timestamp_us  device time of the frame
+ *   frame[GENERIC_SENSOR_ADC_CHANNELS] in the selected encoding, a masked
+ *   frame with CONFIG_GENERIC_SENSOR_REPORT_DIVIDERS
+ */
+#define GS_FRAME_HDR_LEN                6
+
+/* No encoding makes a single frame larger than raw int16 and its mask */
+#define GS_FRAME_MAX_LEN                                                \
+    (GS_FRAME_HDR_LEN + GENERIC_SENSOR_ADC_CHANNELS * sizeof(int16_t) + \
+     IS_ENABLED(CONFIG_GENERIC_SENSOR_REPORT_DIVIDERS))
+
+/* One frame on its way to every subscribed connection */
+struct sensor_fanout {
+    const struct bt_gatt_attr *chrc;
+    const struct generic_sensor_frame *frame;
+    uint32_t now_ms;
+    /* Encoded lazily, at most once per format */
+    uint8_t encoded[GENERIC_SENSOR_ENC_COUNT][GS_FRAME_MAX_LEN];
+    uint16_t len[GENERIC_SENSOR_ENC_COUNT];
+};
+
+static void notify_conn(struct generic_sensor_conn *gc, void *user_data)
 {
-    // printk("update_sensor_values\n");
+    struct sensor_fanout *fanout = user_data;
+    uint8_t format = gc->encoding;
+    uint32_t start;
+    bool triggered;
 
-    // printk("Size of data: %d\n", sizeof(values));
+    /* Nothing to notify while no channel is due */
+    if (!gc->subscribed || !fanout->frame->report) {
+        return;
+    }
 
-    generic_sensor_adc_multi_sample(values);
-    
-    bool notify = check_condition(sensor->condition,
-                    sensor->sensor_values, values,
-                    sensor->ref_val);
+    start = generic_sensor_metrics_start();
+    triggered = generic_sensor_trigger_check(&gc->triggers,
+                        fanout->frame->values, fanout->now_ms);
+    generic_sensor_metrics_stage(GENERIC_SENSOR_STAGE_TRIGGER, start);
+    if (!triggered) {
+        return;
+    }
 
-    // printk("Condition: %s", notify?"true\n":"false\n");
+    if (!fanout->len[format]) {
+        struct generic_sensor_encoder enc;
+        uint8_t *buf = fanout->encoded[format];
+
+        start = generic_sensor_metrics_start();
+        sys_put_le16(fanout->frame->seq, &buf[0]);
+        sys_put_le32(fanout->frame->timestamp_us, &buf[2]);
+        generic_sensor_encoder_init(&enc, format,
+                        GENERIC_SENSOR_ADC_CHANNELS,
+                        &buf[GS_FRAME_HDR_LEN],
+                        sizeof(fanout->encoded[format]) - GS_FRAME_HDR_LEN);
+        if (IS_ENABLED(CONFIG_GENERIC_SENSOR_REPORT_DIVIDERS)) {
+            generic_sensor_encoder_add_masked(&enc, fanout->frame->values,
+                            fanout->frame->report);
+        } else {
+            generic_sensor_encoder_add(&enc, fanout->frame->values);
+        }
+        fanout->len[format] = GS_FRAME_HDR_LEN +
+                        generic_sensor_encoder_finish(&enc);
+        generic_sensor_metrics_stage(GENERIC_SENSOR_STAGE_ENCODE, start);
+    }
+
+    if (!generic_sensor_conn_notify(gc, fanout->chrc,
+                    fanout->encoded[format], fanout->len[format])) {
+        generic_sensor_trigger_sent(&gc->triggers, fanout->frame->values,
+                        fanout->now_ms);
+        generic_sensor_metrics_count(GENERIC_SENSOR_CNT_FRAMES_SENT, 1);
+    }
+}
+
+/* Keep the latest frame for reads of the sensor value */
+static void latch_sensor_values(struct generic_sensor *sensor,
+                const struct generic_sensor_frame *frame)
+{
+    memcpy(sensor->sensor_values, frame->values,
+           sizeof(sensor->sensor_values));
+    generic_sensor_metrics_count(GENERIC_SENSOR_CNT_COPIES, 1);
+}
+
+static void update_sensor_values(const struct bt_gatt_attr *chrc,
+                struct generic_sensor *sensor,
+                const struct generic_sensor_frame *frame, uint32_t now_ms)
+{
+    // printk("update_sensor_values\n");
+
+    struct sensor_fanout fanout = {
+        .chrc = chrc,
+        .frame = frame,
+        .now_ms = now_ms,
+    };
 
     /* Update flow value */
-    sensor->sensor_values[0] = values[0];
-    sensor->sensor_values[1] = values[1];
-    sensor->sensor_values[2] = values[2];
+    latch_sensor_values(sensor, frame);
+
+    /* Each connection's own trigger conditions decide what it gets */
+    generic_sensor_conn_foreach(notify_conn, &fanout);
+}
+
+#ifdef CONFIG_GENERIC_SENSOR_METRICS
+static ssize_t read_gs_diagnostics(struct bt_conn *conn,
+                const struct bt_gatt_attr *attr, void *buf,
+                uint16_t len, uint16_t offset)
+{
+    static uint8_t snapshot[GENERIC_SENSOR_METRICS_LEN +
+                            GENERIC_SENSOR_LINK_LEN];
+    static size_t snapshot_len;
+
+    /* Long reads continue from the snapshot taken by their first part */
+    if (!offset) {
+        snapshot_len = generic_sensor_metrics_snapshot(snapshot,
+                        sizeof(snapshot));
+        /* Followed by the link of the asking central */
+        snapshot_len += generic_sensor_link_snapshot(conn,
+                        &snapshot[snapshot_len],
+                        sizeof(snapshot) - snapshot_len);
+    }
+
+    return bt_gatt_attr_read(conn, attr, buf, len, offset,
+                snapshot, snapshot_len);
+}
+
+#define GS_DIAGNOSTICS_ATTRS                                            \
+    BT_GATT_CHARACTERISTIC(&BT_UUID_GS_DIAGNOSTICS.uuid,                \
+                BT_GATT_CHRC_READ, BT_GATT_PERM_READ,                   \
+                read_gs_diagnostics, NULL, NULL),
+#else
+#define GS_DIAGNOSTICS_ATTRS
+#endif
+
+#ifdef CONFIG_GENERIC_SENSOR_STORE
+struct gs_store_span {
+    uint32_t oldest;
+    uint32_t next;
+} __packed;
+
+struct gs_store_ctrl {
+    uint8_t op;
+    uint32_t from_id;
+} __packed;
+
+#define GS_STORE_OP_CANCEL              0x00
+#define GS_STORE_OP_DOWNLOAD            0x01
+
+static ssize_t read_gs_store(struct bt_conn *conn,
+                const struct bt_gatt_attr *attr, void *buf,
+                uint16_t len, uint16_t offset)
+{
+    LOG_DBG("read_gs_store");
+    struct gs_store_span rp;
+    uint32_t oldest, next;
+
+    generic_sensor_store_span(&oldest, &next);
+    rp.oldest = sys_cpu_to_le32(oldest);
+    rp.next = sys_cpu_to_le32(next);
+
+    return bt_gatt_attr_read(conn, attr, buf, len, offset, &rp, sizeof(rp));
+}
+
+static ssize_t write_gs_store(struct bt_conn *conn,
+                const struct bt_gatt_attr *attr,
+                const void *buf, uint16_t len,
+                uint16_t offset, uint8_t flags)
+{
+    LOG_DBG("write_gs_store");
+    struct generic_sensor_conn *gc = generic_sensor_conn_get(conn);
+    const struct gs_store_ctrl *req = buf;
+    int err;
+
+    if (offset) {
+        return BT_GATT_ERR(BT_ATT_ERR_INVALID_OFFSET);
+    }
+
+    if (len != sizeof(*req)) {
+        return BT_GATT_ERR(BT_ATT_ERR_INVALID_ATTRIBUTE_LEN);
+    }
+
+    if (!gc) {
+        return BT_GATT_ERR(ERR_WRITE_REJECT);
+    }
+
+    switch (req->op) {
+    case GS_STORE_OP_CANCEL:
+        generic_sensor_store_cancel(gc);
+        return len;
+    case GS_STORE_OP_DOWNLOAD:
+        if (!bt_gatt_is_subscribed(conn, attr, BT_GATT_CCC_NOTIFY)) {
+            return BT_GATT_ERR(BT_ATT_ERR_CCC_IMPROPER_CONF);
+        }
+        err = generic_sensor_store_download(gc, attr,
+                        sys_le32_to_cpu(req->from_id));
+        if (err == -EBUSY) {
+            return BT_GATT_ERR(BT_ATT_ERR_PROCEDURE_IN_PROGRESS);
+        }
+        if (err) {
+            return BT_GATT_ERR(ERR_WRITE_REJECT);
+        }
+        return len;
+    default:
+        return BT_GATT_ERR(ERR_COND_NOT_SUPP);
+    }
+}
+
+#define GS_STORE_ATTRS                                                  \
+    BT_GATT_CHARACTERISTIC(&BT_UUID_GS_STORE.uuid,                      \
+                BT_GATT_CHRC_READ | BT_GATT_CHRC_WRITE |                \
+                BT_GATT_CHRC_NOTIFY,                                    \
+                BT_GATT_PERM_READ | BT_GATT_PERM_WRITE,                 \
+                read_gs_store, write_gs_store, NULL),                   \
+    BT_GATT_CCC(NULL, BT_GATT_PERM_READ | BT_GATT_PERM_WRITE),
+#else
+#define GS_STORE_ATTRS
+#endif
+
+/*
+ * Time sync: a write of the central's clock, uint64_t microseconds read
+ * just before sending, aligns the device with it. A read returns
+ * uint64_t device time, int64_t offset to add to reach the central's
+ * clock at that device time, uint8_t synced and int32_t skew of the
+ * central's clock in ppb, to carry the offset to other device times.
+ */
+struct gs_time_sync {
+    uint64_t device_us;
+    int64_t offset_us;
+    uint8_t synced;
+    int32_t skew_ppb;
+} __packed;
+
+static ssize_t read_gs_time_sync(struct bt_conn *conn,
+                const struct bt_gatt_attr *attr, void *buf,
+                uint16_t len, uint16_t offset)
+{
+    LOG_DBG("read_gs_time_sync");
+    struct gs_time_sync rp;
+    uint64_t device_us = generic_sensor_time_now_us();
+    int64_t offset_us;
+    int32_t skew_ppb;
+
+    rp.synced = generic_sensor_time_offset(device_us, &offset_us, &skew_ppb);
+    rp.offset_us = sys_cpu_to_le64(offset_us);
+    rp.device_us = sys_cpu_to_le64(device_us);
+    rp.skew_ppb = sys_cpu_to_le32(skew_ppb);
+
+    return bt_gatt_attr_read(conn, attr, buf, len, offset, &rp, sizeof(rp));
+}
+
+static ssize_t write_gs_time_sync(struct bt_conn *conn,
+                const struct bt_gatt_attr *attr,
+                const void *buf, uint16_t len,
+                uint16_t offset, uint8_t flags)
+{
+    LOG_DBG("write_gs_time_sync");
+
+    if (offset) {
+        return BT_GATT_ERR(BT_ATT_ERR_INVALID_OFFSET);
+    }
+
+    if (len != sizeof(uint64_t)) {
+        return BT_GATT_ERR(BT_ATT_ERR_INVALID_ATTRIBUTE_LEN);
+    }
+
+    generic_sensor_time_sync(sys_get_le64(buf));
+
+    return len;
+}
+
+#ifdef CONFIG_GENERIC_SENSOR_L2CAP
+static ssize_t read_gs_l2cap_psm(struct bt_conn *conn,
+                const struct bt_gatt_attr *attr, void *buf,
+                uint16_t len, uint16_t offset)
+{
+    LOG_DBG("read_gs_l2cap_psm");
+    uint16_t psm = sys_cpu_to_le16(generic_sensor_l2cap_psm());
+
+    return bt_gatt_attr_read(conn, attr, buf, len, offset, &psm, sizeof(psm));
+}
+
+#define GS_L2CAP_ATTRS                                                  \
+    BT_GATT_CHARACTERISTIC(&BT_UUID_GS_L2CAP_PSM.uuid,                  \
+                BT_GATT_CHRC_READ, BT_GATT_PERM_READ,                   \
+                read_gs_l2cap_psm, NULL, NULL),
+#else
+#define GS_L2CAP_ATTRS
+#endif
+
+#ifdef CONFIG_GENERIC_SENSOR_STATS
+static void gs_stats_ccc_cfg_changed(const struct bt_gatt_attr *attr,
+                uint16_t value)
+{
+    LOG_DBG("gs_stats_ccc_cfg_changed");
+    stats_enabled = value == BT_GATT_CCC_NOTIFY;
+    streaming_changed();
+}
+
+static ssize_t read_gs_stats(struct bt_conn *conn,
+                const struct bt_gatt_attr *attr, void *buf,
+                uint16_t len, uint16_t offset)
+{
+    LOG_DBG("read_gs_stats");
+    uint8_t summary[GENERIC_SENSOR_STATS_LEN];
+
+    return bt_gatt_attr_read(conn, attr, buf, len, offset, summary,
+                generic_sensor_stats_last(summary, sizeof(summary)));
+}
+
+static ssize_t read_gs_stats_window(struct bt_conn *conn,
+                const struct bt_gatt_attr *attr, void *buf,
+                uint16_t len, uint16_t offset)
+{
+    LOG_DBG("read_gs_stats_window");
+    uint16_t window_ms = sys_cpu_to_le16(generic_sensor_stats_window());
+
+    return bt_gatt_attr_read(conn, attr, buf, len, offset, &window_ms,
+                sizeof(window_ms));
+}
+
+static ssize_t write_gs_stats_window(struct bt_conn *conn,
+                const struct bt_gatt_attr *attr, const void *buf,
+                uint16_t len, uint16_t offset, uint8_t flags)
+{
+    LOG_DBG("write_gs_stats_window");
+
+    if (offset) {
+        return BT_GATT_ERR(BT_ATT_ERR_INVALID_OFFSET);
+    }
+
+    if (len != sizeof(uint16_t)) {
+        return BT_GATT_ERR(BT_ATT_ERR_INVALID_ATTRIBUTE_LEN);
+    }
+
+    if (generic_sensor_stats_set_window(sys_get_le16(buf))) {
+        return BT_GATT_ERR(ERR_WRITE_REJECT);
+    }
+
+    return len;
+}
+
+#define GS_STATS_ATTRS                                                  \
+    BT_GATT_CHARACTERISTIC(&BT_UUID_GS_STATS.uuid,                      \
+                BT_GATT_CHRC_READ | BT_GATT_CHRC_NOTIFY,                \
+                BT_GATT_PERM_READ, read_gs_stats, NULL, NULL),          \
+    BT_GATT_DESCRIPTOR(&BT_UUID_GS_STATS_WINDOW.uuid,                   \
+            BT_GATT_PERM_READ | BT_GATT_PERM_WRITE,                     \
+            read_gs_stats_window, write_gs_stats_window, NULL),         \
+    BT_GATT_CCC(gs_stats_ccc_cfg_changed,                               \
+            BT_GATT_PERM_READ | BT_GATT_PERM_WRITE),
+#else
+#define GS_STATS_ATTRS
+#endif
+
+#ifdef CONFIG_GENERIC_SENSOR_FFT
+static void gs_spectrum_ccc_cfg_changed(const struct bt_gatt_attr *attr,
+                uint16_t value)
+{
+    LOG_DBG("gs_spectrum_ccc_cfg_changed");
+    spectrum_enabled = value == BT_GATT_CCC_NOTIFY;
+    streaming_changed();
+}
+
+static ssize_t read_gs_spectrum(struct bt_conn *conn,
+                const struct bt_gatt_attr *attr, void *buf,
+                uint16_t len, uint16_t offset)
+{
+    LOG_DBG("read_gs_spectrum");
+    uint8_t summary[GENERIC_SENSOR_FFT_LEN];
+
+    return bt_gatt_attr_read(conn, attr, buf, len, offset, summary,
+                generic_sensor_fft_last(summary, sizeof(summary)));
+}
+
+static ssize_t read_gs_spectrum_bands(struct bt_conn *conn,
+                const struct bt_gatt_attr *attr, void *buf,
+                uint16_t len, uint16_t offset)
+{
+    LOG_DBG("read_gs_spectrum_bands");
+    uint16_t edges[CONFIG_GENERIC_SENSOR_FFT_BANDS];
+    size_t count = generic_sensor_fft_bands(edges, ARRAY_SIZE(edges));
+
+    for (size_t i = 0; i < count; i++) {
+        edges[i] = sys_cpu_to_le16(edges[i]);
+    }
+
+    return bt_gatt_attr_read(conn, attr, buf, len, offset, edges,
+                count * sizeof(edges[0]));
+}
 
-    /* Trigger notification if conditions are met */
-    if (notify) {
-        // values[0] = sys_cpu_to_le16(sensor->sensor_values[0]);
-        // values[1] = sys_cpu_to_le16(sensor->sensor_values[1]);
-        // values[2] = sys_cpu_to_le16(sensor->sensor_values[2]);
+static ssize_t write_gs_spectrum_bands(struct bt_conn *conn,
+                const struct bt_gatt_attr *attr, const void *buf,
+                uint16_t len, uint16_t offset, uint8_t flags)
+{
+    LOG_DBG("write_gs_spectrum_bands");
+    uint16_t edges[CONFIG_GENERIC_SENSOR_FFT_BANDS];
+    const uint8_t *data = buf;
+    size_t count = len / sizeof(edges[0]);
+
+    if (offset) {
+        return BT_GATT_ERR(BT_ATT_ERR_INVALID_OFFSET);
+    }
+
+    if (len % sizeof(edges[0]) || count > ARRAY_SIZE(edges)) {
+        return BT_GATT_ERR(BT_ATT_ERR_INVALID_ATTRIBUTE_LEN);
+    }
 
-        // printk("Size of data: %d\n", sizeof(values));
+    for (size_t i = 0; i < count; i++) {
+        edges[i] = sys_get_le16(&data[i * sizeof(edges[0])]);
+    }
 
-        bt_gatt_notify(conn, chrc, &values, sizeof(values));
+    if (generic_sensor_fft_set_bands(edges, count)) {
+        return BT_GATT_ERR(ERR_WRITE_REJECT);
     }
 
-        // printk("Value: %06d\n", value);
+    return len;
 }
 
+#define GS_SPECTRUM_ATTRS                                               \
+    BT_GATT_CHARACTERISTIC(&BT_UUID_GS_SPECTRUM.uuid,                   \
+                BT_GATT_CHRC_READ | BT_GATT_CHRC_NOTIFY,                \
+                BT_GATT_PERM_READ, read_gs_spectrum, NULL, NULL),       \
+    BT_GATT_DESCRIPTOR(&BT_UUID_GS_SPECTRUM_BANDS.uuid,                 \
+            BT_GATT_PERM_READ | BT_GATT_PERM_WRITE,                     \
+            read_gs_spectrum_bands, write_gs_spectrum_bands, NULL),     \
+    BT_GATT_CCC(gs_spectrum_ccc_cfg_changed,                            \
+            BT_GATT_PERM_READ | BT_GATT_PERM_WRITE),
+#else
+#define GS_SPECTRUM_ATTRS
+#endif
+
+/* One ES Trigger Setting descriptor per channel of the channel table */
+#define GS_TRIGGER_SETTING(i, _)                                        \
+    BT_GATT_DESCRIPTOR(BT_UUID_ES_TRIGGER_SETTING,                      \
+            BT_GATT_PERM_READ | BT_GATT_PERM_WRITE,                     \
+            read_value_trigger_setting, write_value_trigger_setting,    \
+            UINT_TO_POINTER(i)),
+
 BT_GATT_SERVICE_DEFINE(gss_svc,
     BT_GATT_PRIMARY_SERVICE(&BT_UUID_GENERIC_SENSOR_SERVICE),
 
@@ -308,37 +1265,319 @@ BT_GATT_SERVICE_DEFINE(gss_svc,
     BT_GATT_CUD(SENSOR_1_NAME, BT_GATT_PERM_READ),
     BT_GATT_DESCRIPTOR(&BT_UUID_GS_MEASUREMENT.uuid, BT_GATT_PERM_READ,
             read_gs_measurement, NULL, &sensor_1.meas),
+    BT_GATT_DESCRIPTOR(&BT_UUID_GS_ENCODING.uuid,
+            BT_GATT_PERM_READ | BT_GATT_PERM_WRITE,
+            read_gs_encoding, write_gs_encoding, NULL),
+    BT_GATT_DESCRIPTOR(&BT_UUID_GS_FILTER.uuid,
+            BT_GATT_PERM_READ | BT_GATT_PERM_WRITE,
+            read_gs_filter, write_gs_filter, &sensor_1),
     BT_GATT_CUD(SENSOR_1_NAME, BT_GATT_PERM_READ),
     BT_GATT_DESCRIPTOR(BT_UUID_VALID_RANGE, BT_GATT_PERM_READ,
             read_value_valid_range, NULL, &sensor_1),
-    BT_GATT_DESCRIPTOR(BT_UUID_ES_TRIGGER_SETTING,
-            BT_GATT_PERM_READ, read_value_trigger_setting,
-            NULL, &sensor_1),
-    BT_GATT_CCC(gs_ccc_cfg_changed,
+    UTIL_LISTIFY(GENERIC_SENSOR_ADC_CHANNELS, GS_TRIGGER_SETTING, _)
+    BT_GATT_DESCRIPTOR(BT_UUID_ES_CONFIGURATION,
+            BT_GATT_PERM_READ | BT_GATT_PERM_WRITE,
+            read_es_configuration, write_es_configuration, NULL),
+    BT_GATT_CCC_MANAGED(&gs_ccc,
             BT_GATT_PERM_READ | BT_GATT_PERM_WRITE),
 
+    /*  Device clock */
+    BT_GATT_CHARACTERISTIC(&BT_UUID_GS_TIME_SYNC.uuid,
+                BT_GATT_CHRC_READ | BT_GATT_CHRC_WRITE,
+                BT_GATT_PERM_READ | BT_GATT_PERM_WRITE,
+                read_gs_time_sync, write_gs_time_sync, NULL),
+
+    /*  Windowed statistics */
+    GS_STATS_ATTRS
+
+    /*  Spectral features */
+    GS_SPECTRUM_ATTRS
+
+    /*  Pipeline metrics */
+    GS_DIAGNOSTICS_ATTRS
+
+    /*  Offline backlog */
+    GS_STORE_ATTRS
+
+    /*  Raw stream over L2CAP */
+    GS_L2CAP_ATTRS
+
     /*  Sensor 2 */
     /*  Removed */
 );
 
-static void update_sensor_data(void)
+/* Sensor value attribute: follows the service and characteristic declarations */
+#define GS_SENSOR_VALUE_ATTR            (&gss_svc.attrs[2])
+
+/* Frame i of a block that ended at timestamp_us and spanned block_us */
+static uint32_t frame_time_us(uint32_t timestamp_us, uint32_t block_us,
+                              size_t frames, size_t i)
 {
-    static uint8_t i;
+    return timestamp_us -
+           (uint32_t)((uint64_t)block_us * (frames - 1 - i) / frames);
+}
+
+BUILD_ASSERT(IS_ENABLED(CONFIG_GENERIC_SENSOR_REPORT_DIVIDERS) ||
+             !DT_NODE_HAS_PROP(GENERIC_SENSOR_ADC_NODE, report_dividers),
+             "report-dividers need CONFIG_GENERIC_SENSOR_REPORT_DIVIDERS");
+
+/* The channels to report in the next frame, by their report dividers */
+static uint8_t report_mask(const struct device *dev)
+{
+    static uint16_t left[GENERIC_SENSOR_ADC_CHANNELS];
+    uint8_t mask = 0;
 
-    if (!(i % SENSOR_1_UPDATE_IVAL)) {
-        // time = k_uptime_get();
-        update_sensor_values(NULL, &gss_svc.attrs[2], &sensor_1);
-        // last_time = k_uptime_get();
-        // printk("Time passed: %lli ms\n", last_time - time);
+    if (!IS_ENABLED(CONFIG_GENERIC_SENSOR_REPORT_DIVIDERS)) {
+        return BIT_MASK(GENERIC_SENSOR_ADC_CHANNELS);
     }
 
-    if (!(i % 100U)) {
-        i = 0U; // unsigned int
+    for (int ch = 0; ch < GENERIC_SENSOR_ADC_CHANNELS; ch++) {
+        uint16_t divider = generic_sensor_adc_report_divider(dev, ch);
+
+        /* A lowered divider takes effect right away */
+        if (!left[ch] || left[ch] >= divider) {
+            mask |= BIT(ch);
+            left[ch] = divider - 1;
+        } else {
+            left[ch]--;
+        }
     }
 
-    i++;
+    return mask;
+}
+
+/*
+ * Producer: runs on the ADC sampling thread and only queues frames, so a
+ * congested link never delays the next acquisition.
+ */
+static void sensor_block_ready(const struct device *dev, const int16_t *block,
+                size_t frames, uint32_t timestamp_us)
+{
+    static uint16_t seq;
+    static uint32_t prev_block_us;
+    const uint32_t nominal_us = frames * SENSOR_1_SAMPLE_IVAL_US;
+    struct generic_sensor_frame dropped;
+    uint32_t block_us;
+    uint32_t start;
+    size_t n = 0;
+
+    if (!sensor_sampling() && !IS_ENABLED(CONFIG_GENERIC_SENSOR_STORE)) {
+        return;
+    }
+
+    /*
+     * Spread the frames over the time that really passed since the last
+     * block, so the ADC timer drifting against the RTC never accumulates
+     * into the timestamps. After a pause there is no such reference.
+     */
+    block_us = timestamp_us - prev_block_us;
+    if (block_us > 2 * nominal_us) {
+        block_us = nominal_us;
+    }
+    prev_block_us = timestamp_us;
+
+    start = generic_sensor_metrics_start();
+
+    /*
+     * The spectrum sees every sample, before decimation: the filter output
+     * would limit it to half the output frame rate
+     */
+    if (spectrum_enabled) {
+        for (size_t i = 0; i < frames; i++) {
+            struct generic_sensor_frame raw;
+
+            generic_sensor_adc_convert(dev,
+                    &block[i * GENERIC_SENSOR_ADC_CHANNELS], raw.values);
+            raw.timestamp_us = frame_time_us(timestamp_us, block_us, frames,
+                                             i);
+            generic_sensor_fft_add(&raw);
+        }
+    }
+
+    /*
+     * The filter writes straight into the next free ring slot, where the
+     * frame is converted and published. With the ring full the filter
+     * still has to see every frame, its output is then dropped.
+     */
+    for (size_t i = 0; i < frames; i++) {
+        struct generic_sensor_frame *slot = generic_sensor_ring_claim();
+        struct generic_sensor_frame *out = slot ? slot : &dropped;
+
+        if (!generic_sensor_filter_feed(&block[i * GENERIC_SENSOR_ADC_CHANNELS],
+                                        out->values)) {
+            continue;
+        }
+
+        generic_sensor_adc_convert(dev, out->values, out->values);
+        out->timestamp_us = frame_time_us(timestamp_us, block_us, frames, i);
+        out->seq = seq++;
+        out->report = report_mask(dev);
+
+        if (slot) {
+            generic_sensor_ring_publish();
+            n++;
+        } else if (generic_sensor_ring_put(out)) {
+            /* The consumer made room in the meantime */
+            n++;
+        } else {
+            generic_led_event(GENERIC_LED_OVERFLOW);
+        }
+    }
+    generic_sensor_metrics_stage(GENERIC_SENSOR_STAGE_FILTER, start);
+
+    if (n) {
+        k_sem_give(&sensor_tx_sem);
+    }
+}
+
+/* Consumer: one frame, read in place from the ring */
+static void sensor_tx_frame(const struct generic_sensor_frame *frame)
+{
+    // time = k_uptime_get();
+    if (stats_enabled) {
+        generic_sensor_stats_add(frame);
+    }
+    /* Same frames as the notifications, in large SDUs */
+    generic_sensor_l2cap_add(frame);
+#ifdef CONFIG_GENERIC_SENSOR_STORE
+    /* Nobody listens: keep the frame for a later download */
+    if (!sensor_streaming()) {
+        generic_sensor_store_add(frame);
+        return;
+    }
+#endif
+#ifdef CONFIG_GENERIC_SENSOR_BATCH
+    batch_frame(frame);
+    latch_sensor_values(&sensor_1, frame);
+#else
+    update_sensor_values(GS_SENSOR_VALUE_ATTR, &sensor_1, frame,
+                         k_uptime_get_32());
+#endif
+    // last_time = k_uptime_get();
+    // printk("Time passed: %lli ms\n", last_time - time);
+}
+
+/* Consumer: drains the ring into notifications */
+static void sensor_tx_thread(void)
+{
+    const struct generic_sensor_frame *frame;
+
+    while (1) {
+        k_sem_take(&sensor_tx_sem, K_FOREVER);
+
+        while ((frame = generic_sensor_ring_peek())) {
+            sensor_tx_frame(frame);
+            generic_sensor_ring_release();
+        }
+    }
+}
+
+K_THREAD_DEFINE(sensor_tx_tid, SENSOR_TX_THREAD_STACK_SIZE, sensor_tx_thread,
+                NULL, NULL, NULL, SENSOR_TX_THREAD_PRIORITY, 0, 0);
+
+#if defined(CONFIG_GENERIC_SENSOR_STATS) || defined(CONFIG_GENERIC_SENSOR_FFT)
+/* One window summary on its way to every subscribed connection */
+struct summary_fanout {
+    const struct bt_gatt_attr *chrc;
+    const uint8_t *summary;
+    uint16_t len;
+};
+
+static void send_summary_conn(struct generic_sensor_conn *gc, void *user_data)
+{
+    struct summary_fanout *fanout = user_data;
+
+    if (bt_gatt_is_subscribed(gc->conn, fanout->chrc, BT_GATT_CCC_NOTIFY)) {
+        generic_sensor_conn_notify(gc, fanout->chrc, fanout->summary,
+                        fanout->len);
+    }
 }
 
+static void send_summary(const struct bt_uuid *uuid,
+                const uint8_t *summary, uint16_t len)
+{
+    struct summary_fanout fanout = {
+        .chrc = bt_gatt_find_by_uuid(gss_svc.attrs, gss_svc.attr_count,
+                        uuid),
+        .summary = summary,
+        .len = len,
+    };
+
+    generic_sensor_conn_foreach(send_summary_conn, &fanout);
+}
+#endif
+
+#ifdef CONFIG_GENERIC_SENSOR_STATS
+/* Runs on the transmit thread once per window */
+static void send_stats(const uint8_t *summary, uint16_t len)
+{
+    send_summary(&BT_UUID_GS_STATS.uuid, summary, len);
+}
+#endif
+
+#ifdef CONFIG_GENERIC_SENSOR_FFT
+/* Runs on the FFT thread once per transformed window */
+static void send_spectrum(const uint8_t *summary, uint16_t len)
+{
+    send_summary(&BT_UUID_GS_SPECTRUM.uuid, summary, len);
+}
+#endif
+
+#ifdef CONFIG_GENERIC_SENSOR_BATCH
+struct batch_fanout {
+    const struct generic_sensor_batch *batch;
+    const void *data;
+    uint16_t len;
+    int sent;
+};
+
+static void send_batch_conn(struct generic_sensor_conn *gc, void *user_data)
+{
+    struct batch_fanout *fanout = user_data;
+
+    if (gc->subscribed && gc->encoding == fanout->batch->encoding &&
+        (batch_recipients[gc->encoding] & BIT(bt_conn_index(gc->conn))) &&
+        !generic_sensor_conn_notify(gc, GS_SENSOR_VALUE_ATTR,
+                        fanout->data, fanout->len)) {
+        fanout->sent++;
+        generic_sensor_metrics_count(GENERIC_SENSOR_CNT_FRAMES_SENT,
+                        fanout->batch->count);
+    }
+}
+
+static int send_batch(struct generic_sensor_batch *batch,
+                const void *data, uint16_t len)
+{
+    struct batch_fanout fanout = {
+        .batch = batch,
+        .data = data,
+        .len = len,
+    };
+
+    generic_sensor_conn_foreach(send_batch_conn, &fanout);
+
+    return fanout.sent ? 0 : -ENOTCONN;
+}
+#endif
+
+static void mtu_updated(struct bt_conn *conn, uint16_t tx, uint16_t rx)
+{
+    struct generic_sensor_conn *gc = generic_sensor_conn_get(conn);
+
+    LOG_INF("MTU updated: tx %d rx %d", tx, rx);
+    if (gc) {
+        gc->mtu = bt_gatt_get_mtu(conn);
+#ifdef CONFIG_GENERIC_SENSOR_BATCH
+        update_batches();
+#endif
+        update_link(gc, NULL);
+    }
+}
+
+static struct bt_gatt_cb gatt_callbacks = {
+    .att_mtu_updated = mtu_updated,
+};
+
 static const struct bt_data ad[] = {
     BT_DATA_BYTES(BT_DATA_FLAGS, (BT_LE_AD_GENERAL | BT_LE_AD_NO_BREDR)),
     BT_DATA_BYTES(BT_DATA_GAP_APPEARANCE, 0x00, 0x03),
@@ -350,18 +1589,27 @@ static const struct bt_data ad[] = {
 static void connected(struct bt_conn *conn, uint8_t err)
 {
     if (err) {
-        printk("Connection failed (err 0x%02x)\n", err);
+        LOG_WRN("Connection failed (err 0x%02x)", err);
     } else {
-        printk("Connected\n");
-        blink_red_led_flag = 0;
-        red_led_on();
+        LOG_INF("Connected");
+        generic_sensor_conn_add(conn, &sensor_1.triggers);
+        update_led();
     }
 }
 
 static void disconnected(struct bt_conn *conn, uint8_t reason)
 {
-    printk("Disconnected (reason 0x%02x)\n", reason);
-    blink_red_led_flag = 1;
+    LOG_INF("Disconnected (reason 0x%02x)", reason);
+
+#ifdef CONFIG_GENERIC_SENSOR_STORE
+    generic_sensor_store_cancel(generic_sensor_conn_get(conn));
+#endif
+    generic_sensor_conn_remove(conn);
+#ifdef CONFIG_GENERIC_SENSOR_BATCH
+    update_batches();
+#endif
+
+    update_led();
 }
 
 static struct bt_conn_cb conn_callbacks = {
@@ -372,27 +1620,28 @@ static struct bt_conn_cb conn_callbacks = {
 static void bt_ready(void)
 {
     int err;
-    printk("Bluetooth initialized\n");
+    LOG_INF("Bluetooth initialized");
     err = bt_le_adv_start(BT_LE_ADV_CONN_NAME, ad, ARRAY_SIZE(ad), NULL, 0);
     if (err) {
-        printk("Advertising failed to start (err %d)\n", err);
+        LOG_ERR("Advertising failed to start (err %d)", err);
+        generic_led_set_state(GENERIC_LED_ERROR);
         return;
     }
-    printk("Advertising successfully started\n");
+    LOG_INF("Advertising successfully started");
 }
 
 static void auth_passkey_display(struct bt_conn *conn, unsigned int passkey)
 {
     char addr[BT_ADDR_LE_STR_LEN];
     bt_addr_le_to_str(bt_conn_get_dst(conn), addr, sizeof(addr));
-    printk("Passkey for %s: %06u\n", addr, passkey);
+    LOG_INF("Passkey for %s: %06u", log_strdup(addr), passkey);
 }
 
 static void auth_cancel(struct bt_conn *conn)
 {
     char addr[BT_ADDR_LE_STR_LEN];
     bt_addr_le_to_str(bt_conn_get_dst(conn), addr, sizeof(addr));
-    printk("Pairing cancelled: %s\n", addr);
+    LOG_INF("Pairing cancelled: %s", log_strdup(addr));
 }
 
 static struct bt_conn_auth_cb auth_cb_display = {
@@ -401,67 +1650,91 @@ static struct bt_conn_auth_cb auth_cb_display = {
     .cancel = auth_cancel,
 };
 
-static void bas_notify(void)
-{
-    uint8_t battery_level = bt_bas_get_battery_level();
-
-    battery_level--;
-
-    if (!battery_level) {
-        battery_level = 100U;
-    }
-
-    bt_bas_set_battery_level(battery_level);
-}
-
 void main(void)
 {
     int err;
 
     err = generic_led_init();
     if (err) {
-        printk("LED error! (err %d)\n", err);
+        LOG_ERR("LED error! (err %d)", err);
         return;
     }
 
-    err = generic_sensor_adc_init();
-    if (err) {
-        printk("ADC error! (err %d)\n", err);
+    if (!device_is_ready(SENSOR_1_ADC)) {
+        LOG_ERR("ADC error! (%s not ready)", SENSOR_1_ADC->name);
+        generic_led_set_state(GENERIC_LED_ERROR);
         return;
     }
 
+    /* Sampling works uncalibrated, only less accurately */
+    err = generic_sensor_cal_init(SENSOR_1_ADC);
+    if (err) {
+        LOG_WRN("ADC calibration failed (err %d)", err);
+    }
+
+    const struct generic_sensor_filter_cfg filter = {
+        .type = SENSOR_1_FILTER_TYPE,
+        .ratio = SENSOR_1_FILTER_RATIO,
+    };
+
+    apply_filter(&sensor_1, &filter);
+
+#ifdef CONFIG_GENERIC_SENSOR_BENCH
+    /* Measure the pipeline instead of serving centrals */
+    generic_sensor_bench_run();
+    return;
+#endif
+
     err = bt_enable(NULL);
     if (err) {
-        printk("Bluetooth init failed (err %d)\n", err);
+        LOG_ERR("Bluetooth init failed (err %d)", err);
+        generic_led_set_state(GENERIC_LED_ERROR);
         return;
     }
 
-    bt_ready();
-    bt_conn_cb_register(&conn_callbacks);
-    bt_conn_auth_cb_register(&auth_cb_display);
+#ifdef CONFIG_GENERIC_SENSOR_BATCH
+    for (int i = 0; i < GENERIC_SENSOR_ENC_COUNT; i++) {
+        generic_sensor_batch_init(&batches[i], i, send_batch,
+                                  CONFIG_GENERIC_SENSOR_BATCH_LATENCY_MS);
+    }
+#endif
+    bt_gatt_cb_register(&gatt_callbacks);
 
-    static int i = 0;
-    while (1) {
-        k_sleep(K_MSEC(1));
+    generic_sensor_link_init();
 
-        /* Update sensor data */
-        if (notify_enabled) {
+    err = generic_sensor_l2cap_init(l2cap_channel_changed);
+    if (err) {
+        LOG_ERR("L2CAP stream init failed (err %d)", err);
+    }
 
-            update_sensor_data();
+#ifdef CONFIG_GENERIC_SENSOR_STATS
+    generic_sensor_stats_init(send_stats);
+#endif
+#ifdef CONFIG_GENERIC_SENSOR_FFT
+    generic_sensor_fft_init(send_spectrum);
+#endif
+
+#ifdef CONFIG_GENERIC_SENSOR_STORE
+    /* Readings taken before the first central connects are kept too */
+    generic_sensor_store_init();
+    generic_sensor_adc_start(SENSOR_1_ADC, SENSOR_1_SAMPLE_IVAL_US,
+                             sensor_1_blocks, GENERIC_SENSOR_ADC_BLOCK_FRAMES,
+                             sensor_block_ready);
+#endif
 
-        }
-
-        /* Battery level simulation */
-        bas_notify();
+    bt_ready();
+    bt_conn_cb_register(&conn_callbacks);
+    bt_conn_auth_cb_register(&auth_cb_display);
 
-        if (i == 0){
-            if(blink_red_led_flag){
-                red_led_blink();
-            }
-        }
-        i++;
-        if (i >= 1000) {
-            i=0;
-        }
+    /*
+     * Everything from here on is event driven: sampling runs off the ADC
+     * interval timer, the LEDs off their own timer and the rest off
+     * delayable work on the system workqueue. main() returns and the CPU
+     * idles until the next deadline.
+     */
+    err = generic_battery_init(SENSOR_1_ADC);
+    if (err) {
+        LOG_WRN("Battery monitor failed (err %d)", err);
     }
+    update_led();
 }
@@ -0,0 +1,251 @@
+/*
+ * Round trips through the wire encodings and the reference decoder
+ *
+ * SPDX-License-Identifier: Apache-2.0
+ */
+
+#include <ztest.h>
+#include <errno.h>
+
+#include "generic_sensor_encode.h"
+
+#define CHANNELS    3
+#define FRAMES      6
+
+/* Extremes next to each other, so every step is a worst-case delta */
+static const int16_t m_edges[FRAMES][CHANNELS] = {
+    { 0, -1, 1 },
+    { -32768, 32767, -8193 },
+    { 32767, -32768, 8192 },
+    { -32768, 32767, -8192 },
+    { 8191, 0, 32767 },
+    { -1, -32768, 0 },
+};
+
+static int16_t clamp14(int16_t v)
+{
+    return v < -8192 ? -8192 : v > 8191 ? 8191 : v;
+}
+
+static size_t encode(uint8_t format, const int16_t frames[][CHANNELS],
+                     uint16_t count, uint8_t *buf, size_t size)
+{
+    struct generic_sensor_encoder enc;
+
+    generic_sensor_encoder_init(&enc, format, CHANNELS, buf, size);
+    for (int i = 0; i < count; i++) {
+        zassert_equal(generic_sensor_encoder_add(&enc, frames[i]), 0,
+                      "frame %d does not fit", i);
+    }
+
+    return generic_sensor_encoder_finish(&enc);
+}
+
+static void round_trip(uint8_t format, bool clamped)
+{
+    uint8_t buf[FRAMES * CHANNELS * 3];
+    int16_t out[FRAMES][CHANNELS];
+    size_t len = encode(format, m_edges, FRAMES, buf, sizeof(buf));
+    int ret;
+
+    zassert_true(len <= FRAMES * generic_sensor_encode_max_frame_len(
+                     format, CHANNELS), "longer than the worst case");
+
+    ret = generic_sensor_decode(format, CHANNELS, buf, len, &out[0][0],
+                                FRAMES);
+    zassert_equal(ret, len, "decoded %d of %u bytes", ret, len);
+
+    for (int i = 0; i < FRAMES; i++) {
+        for (int j = 0; j < CHANNELS; j++) {
+            int16_t expect = clamped ? clamp14(m_edges[i][j]) : m_edges[i][j];
+
+            zassert_equal(out[i][j], expect, "frame %d ch %d: %d != %d",
+                          i, j, out[i][j], expect);
+        }
+    }
+}
+
+static void test_raw16(void)
+{
+    round_trip(GENERIC_SENSOR_ENC_RAW16, false);
+}
+
+static void test_packed14(void)
+{
+    round_trip(GENERIC_SENSOR_ENC_PACKED14, true);
+}
+
+static void test_delta(void)
+{
+    round_trip(GENERIC_SENSOR_ENC_DELTA, false);
+}
+
+/*
+ * Every notification starts its own encoder, so the frame after a gap in
+ * the sequence is a keyframe and decodes without the frames before it.
+ */
+static void test_delta_gap(void)
+{
+    uint8_t first[FRAMES * CHANNELS * 3];
+    uint8_t second[FRAMES * CHANNELS * 3];
+    int16_t out[FRAMES / 2][CHANNELS];
+    size_t len;
+
+    encode(GENERIC_SENSOR_ENC_DELTA, m_edges, FRAMES / 2, first,
+           sizeof(first));
+    len = encode(GENERIC_SENSOR_ENC_DELTA, &m_edges[FRAMES / 2], FRAMES / 2,
+                 second, sizeof(second));
+
+    /* Keyframe in raw little endian */
+    zassert_equal((int16_t)(second[0] | second[1] << 8),
+                  m_edges[FRAMES / 2][0], "no keyframe after the gap");
+
+    zassert_equal(generic_sensor_decode(GENERIC_SENSOR_ENC_DELTA, CHANNELS,
+                                        second, len, &out[0][0],
+                                        FRAMES / 2), len, NULL);
+    for (int i = 0; i < FRAMES / 2; i++) {
+        for (int j = 0; j < CHANNELS; j++) {
+            zassert_equal(out[i][j], m_edges[FRAMES / 2 + i][j],
+                          "frame %d ch %d", i, j);
+        }
+    }
+}
+
+/* A frame that does not fit is rolled back, earlier ones stay intact */
+static void test_full(void)
+{
+    struct generic_sensor_encoder enc;
+    uint8_t buf[2 * CHANNELS * 2 + 1];
+    int16_t out[2][CHANNELS];
+    size_t len;
+
+    generic_sensor_encoder_init(&enc, GENERIC_SENSOR_ENC_RAW16, CHANNELS,
+                                buf, sizeof(buf));
+    zassert_equal(generic_sensor_encoder_add(&enc, m_edges[0]), 0, NULL);
+    zassert_equal(generic_sensor_encoder_add(&enc, m_edges[1]), 0, NULL);
+    zassert_equal(generic_sensor_encoder_add(&enc, m_edges[2]), -ENOMEM,
+                  NULL);
+    zassert_equal(enc.frames, 2, NULL);
+
+    len = generic_sensor_encoder_finish(&enc);
+    zassert_equal(len, 2 * CHANNELS * 2, NULL);
+    zassert_equal(generic_sensor_decode(GENERIC_SENSOR_ENC_RAW16, CHANNELS,
+                                        buf, len, &out[0][0], 2), len, NULL);
+    zassert_equal(out[1][1], 32767, NULL);
+}
+
+static void test_truncated(void)
+{
+    uint8_t buf[FRAMES * CHANNELS * 3];
+    int16_t out[FRAMES][CHANNELS];
+
+    for (uint8_t format = 0; format < GENERIC_SENSOR_ENC_COUNT; format++) {
+        size_t len = encode(format, m_edges, FRAMES, buf, sizeof(buf));
+
+        zassert_equal(generic_sensor_decode(format, CHANNELS, buf, len - 1,
+                                            &out[0][0], FRAMES), -EINVAL,
+                      "format %u accepted a short buffer", format);
+    }
+}
+
+/* Channel 0 every frame, channel 1 every other, channel 2 once, none */
+static const uint8_t m_masks[FRAMES] = { 0x3, 0x1, 0x7, 0x1, 0x0, 0x3 };
+
+static void masked_round_trip(uint8_t format, bool clamped)
+{
+    struct generic_sensor_encoder enc;
+    uint8_t buf[FRAMES * (CHANNELS * 3 + 1)];
+    int16_t out[FRAMES][CHANNELS] = { 0 };
+    uint8_t masks[FRAMES];
+    size_t len;
+    int ret;
+
+    generic_sensor_encoder_init(&enc, format, CHANNELS, buf, sizeof(buf));
+    for (int i = 0; i < FRAMES; i++) {
+        zassert_equal(generic_sensor_encoder_add_masked(&enc, m_edges[i],
+                                                        m_masks[i]), 0,
+                      "frame %d does not fit", i);
+    }
+    len = generic_sensor_encoder_finish(&enc);
+    zassert_true(len <= FRAMES * generic_sensor_encode_max_masked_frame_len(
+                     format, CHANNELS), "longer than the worst case");
+
+    ret = generic_sensor_decode_masked(format, CHANNELS, buf, len,
+                                       &out[0][0], masks, FRAMES);
+    zassert_equal(ret, len, "decoded %d of %u bytes", ret, len);
+
+    for (int i = 0; i < FRAMES; i++) {
+        zassert_equal(masks[i], m_masks[i], "frame %d mask", i);
+        for (int j = 0; j < CHANNELS; j++) {
+            int16_t expect = !(m_masks[i] & BIT(j)) ? 0 :
+                             clamped ? clamp14(m_edges[i][j]) : m_edges[i][j];
+
+            zassert_equal(out[i][j], expect, "frame %d ch %d: %d != %d",
+                          i, j, out[i][j], expect);
+        }
+    }
+}
+
+static void test_masked(void)
+{
+    masked_round_trip(GENERIC_SENSOR_ENC_RAW16, false);
+    masked_round_trip(GENERIC_SENSOR_ENC_PACKED14, true);
+    masked_round_trip(GENERIC_SENSOR_ENC_DELTA, false);
+}
+
+/* Only the channels in the mask cost space, an empty frame one byte */
+static void test_masked_size(void)
+{
+    struct generic_sensor_encoder enc;
+    uint8_t buf[16];
+
+    generic_sensor_encoder_init(&enc, GENERIC_SENSOR_ENC_RAW16, CHANNELS,
+                                buf, sizeof(buf));
+    generic_sensor_encoder_add_masked(&enc, m_edges[0], 0x4);
+    generic_sensor_encoder_add_masked(&enc, m_edges[1], 0x0);
+    zassert_equal(generic_sensor_encoder_finish(&enc), 1 + 2 + 1, NULL);
+
+    /* The first sample of a channel is its keyframe, however late */
+    generic_sensor_encoder_init(&enc, GENERIC_SENSOR_ENC_DELTA, CHANNELS,
+                                buf, sizeof(buf));
+    generic_sensor_encoder_add_masked(&enc, m_edges[0], 0x1);
+    generic_sensor_encoder_add_masked(&enc, m_edges[1], 0x3);
+    zassert_equal(generic_sensor_encoder_finish(&enc), 1 + 2 + 1 + 3 + 2,
+                  NULL);
+    zassert_equal((int16_t)(buf[7] | buf[8] << 8), m_edges[1][1],
+                  "no keyframe for a channel's first sample");
+}
+
+static void test_masked_invalid(void)
+{
+    struct generic_sensor_encoder enc;
+    uint8_t buf[16] = { 0x8 };
+    int16_t out[CHANNELS];
+    uint8_t mask;
+
+    generic_sensor_encoder_init(&enc, GENERIC_SENSOR_ENC_RAW16, CHANNELS,
+                                buf, sizeof(buf));
+    zassert_equal(generic_sensor_encoder_add_masked(&enc, m_edges[0], 0x8),
+                  -EINVAL, NULL);
+    zassert_equal(enc.frames, 0, NULL);
+
+    zassert_equal(generic_sensor_decode_masked(GENERIC_SENSOR_ENC_RAW16,
+                                               CHANNELS, buf, sizeof(buf),
+                                               out, &mask, 1), -EINVAL,
+                  "mask beyond the channels accepted");
+}
+
+void test_main(void)
+{
+    ztest_test_suite(generic_sensor_encode,
+                     ztest_unit_test(test_raw16),
+                     ztest_unit_test(test_packed14),
+                     ztest_unit_test(test_delta),
+                     ztest_unit_test(test_delta_gap),
+                     ztest_unit_test(test_full),
+                     ztest_unit_test(test_truncated),
+                     ztest_unit_test(test_masked),
+                     ztest_unit_test(test_masked_size),
+                     ztest_unit_test(test_masked_invalid));
+    ztest_run_test_suite(generic_sensor_encode);
+}
@@ -0,0 +1,59 @@
+/*
+ * Rounding of the shared integer helpers
+ *
+ * SPDX-License-Identifier: Apache-2.0
+ */
+
+#include <ztest.h>
+
+#include "generic_sensor_math.h"
+
+/* Reference: round half away from zero in floating point */
+static int32_t reference(int32_t sum, uint32_t n)
+{
+    double q = (double)sum / n;
+
+    return (int32_t)(q < 0 ? q - 0.5 : q + 0.5);
+}
+
+/* Halves must round the same way whether n is a shift or a division */
+static void test_halves(void)
+{
+    zassert_equal(generic_sensor_div_round(-3, 2), -2, NULL);
+    zassert_equal(generic_sensor_div_round(3, 2), 2, NULL);
+    zassert_equal(generic_sensor_div_round(-1, 2), -1, NULL);
+    zassert_equal(generic_sensor_div_round(-2, 4), -1, NULL);
+    zassert_equal(generic_sensor_div_round(-6, 4), -2, NULL);
+    zassert_equal(generic_sensor_div_round(-3, 6), -1, NULL);
+    zassert_equal(generic_sensor_div_round(-9, 6), -2, NULL);
+}
+
+static void test_reference(void)
+{
+    static const uint32_t divisors[] = { 1, 2, 3, 4, 5, 8, 10, 16, 64, 100 };
+
+    for (int i = 0; i < ARRAY_SIZE(divisors); i++) {
+        for (int32_t sum = -1000; sum <= 1000; sum++) {
+            zassert_equal(generic_sensor_div_round(sum, divisors[i]),
+                          reference(sum, divisors[i]), "%d / %u", sum,
+                          divisors[i]);
+        }
+    }
+}
+
+/* Sums of full scale 16-bit samples, as the filter accumulates them */
+static void test_extremes(void)
+{
+    zassert_equal(generic_sensor_div_round(-32768 * 64, 64), -32768, NULL);
+    zassert_equal(generic_sensor_div_round(32767 * 64, 64), 32767, NULL);
+    zassert_equal(generic_sensor_div_round(-32768 * 100, 100), -32768, NULL);
+}
+
+void test_main(void)
+{
+    ztest_test_suite(generic_sensor_math,
+                     ztest_unit_test(test_halves),
+                     ztest_unit_test(test_reference),
+                     ztest_unit_test(test_extremes));
+    ztest_run_test_suite(generic_sensor_math);
+}